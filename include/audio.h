@@ -0,0 +1,62 @@
+#pragma once
+
+#include <SDL2/SDL.h>
+#include <atomic>
+#include <cstdint>
+
+#include "machine.h"
+#include "spsc_ring.h"
+
+namespace chip8{
+
+// Square wave beeper played from SDL's audio thread. The emulation queues the
+// sound timer once per tick and the callback turns every queued tick into
+// exactly sample_rate / TIMER_HZ samples, so beeps start and stop on tick
+// boundaries. Neither side locks or waits on the other
+class Audio{
+public:
+    static constexpr int sample_rate = 44100;
+    static constexpr int samples_per_tick = sample_rate / TIMER_HZ;
+    // Ticks that can be queued, the most audio can lag behind the emulation
+    static constexpr size_t queued_ticks = 8;
+    // Ticks queued before the device starts, so a late tick does not run the queue dry right away
+    static constexpr int prefill_ticks = 2;
+
+    // `pitch` in Hz, `volume` from 0 to 100
+    Audio(uint32_t pitch, uint32_t volume);
+    ~Audio();
+    Audio(const Audio &) = delete;
+    Audio &operator=(const Audio &) = delete;
+
+    // False if no audio device could be opened, the emulator then runs silent
+    bool opened() const;
+
+    // Queues one tick of sound, called by the emulation after every scheduler tick with
+    // the sound timer as it is after the tick (0 for silence)
+    void queueTick(uint8_t sound_timer);
+
+    // Ticks the callback found nothing queued for and had to guess, see callback()
+    uint64_t underruns() const;
+    // Ticks that were dropped because the queue was full
+    uint64_t overruns() const;
+
+private:
+    static void SDLCALL callback(void *userdata, Uint8 *stream, int length);
+
+    SDL_AudioDeviceID device;
+    SpscRing<uint8_t, queued_ticks> ticks;
+    std::atomic<uint64_t> underrun_count;
+    std::atomic<uint64_t> overrun_count;
+    // Only touched by the emulation thread
+    int prefill_left;
+
+    // Only touched by the audio thread
+    uint8_t sound_timer;    // of the tick being played
+    bool playing;
+    int tick_left;          // samples left of the tick being played
+    uint32_t phase;         // position in the current period, a full period is 2^32
+    uint32_t phase_step;    // added per sample
+    int16_t amplitude;
+};
+
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "runner.h"
+#include "thread_pool.h"
+
+namespace chip8{
+
+struct BatchJob {
+    std::string rom;
+    RunOptions options;
+};
+
+// Reads the jobs of a batch. `source` is either a directory, every .ch8 or .c8
+// file in it becomes a job with `defaults`, or a manifest with one job per line:
+//   path[<tab>frames[<tab>cpu_hz[<tab>seed]]]
+// where missing fields come from `defaults` and '#' starts a comment line
+bool loadBatch(const std::string &source, const RunOptions &defaults, std::vector<BatchJob> &jobs);
+
+// Runs every job on `pool` and writes a tab separated results table to `out`,
+// one row per job in the order of `jobs`
+void runBatch(const std::vector<BatchJob> &jobs, ThreadPool &pool, std::ostream &out);
+
+}
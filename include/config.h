@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "keymap.h"
+#include "waiter.h"
+
+namespace chip8{
+
+// Settings read from Files/config. The first line is the ROM name, the
+// following lines may hold `key = value` options, lines starting with '#' are comments.
+// Options after a `[ROM name]` line only apply when that ROM is the one loaded
+struct Config{
+    std::string rom;
+    uint32_t instructions_per_second = 700; // 0 means unlimited
+    Waiter::Mode wait_mode = Waiter::Mode::hybrid;
+    bool dynarec = false;
+    uint32_t tone_hz = 440;
+    uint32_t volume = 25;       // percent
+    Keymap keymap;
+    uint32_t rewind_seconds = 30;   // 0 turns rewinding off
+    SDL_Scancode rewind_key = SDL_SCANCODE_BACKSPACE;
+
+    bool load(const std::string &path);
+};
+
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace chip8{
+
+class Machine;
+
+// Translates straight runs of register/ALU instructions (6XNN, 7XNN, 8XYN,
+// ANNN, FX1E, FX29, FX65) into x86-64 code and caches the result by address.
+// A block ends before the first instruction it cannot translate (jumps, skips,
+// calls, DXYN, timers, keys, memory writes...) which the interpreter then runs.
+// Only available on x86-64 Linux builds with CHIP8_DYNAREC, see supported()
+class Dynarec{
+public:
+    static constexpr int max_block = 64;        // instructions per block
+    static constexpr size_t buffer_size = 1 << 20; // bytes of generated code before everything is flushed
+
+    static bool supported();
+
+    Dynarec();
+    ~Dynarec();
+    Dynarec(const Dynarec &) = delete;
+    Dynarec &operator=(const Dynarec &) = delete;
+
+    // Runs the block at the machine's pc, translating it the first time. Blocks
+    // longer than `budget` are not run. Returns how many instructions were
+    // executed, 0 means the interpreter has to run the next instruction
+    uint64_t execute(Machine &machine, uint64_t budget);
+
+    // Drops every block that covers a byte in [address, address + length)
+    void invalidate(uint16_t address, uint16_t length);
+    void flush();
+
+private:
+    using BlockFn = void (*)(unsigned char *V, uint16_t *I, const unsigned char *memory);
+
+    struct Block {
+        BlockFn code;
+        uint8_t length;     // in instructions, 0 if there is nothing worth translating here
+        bool translated;
+    };
+
+    void translate(const Machine &machine, uint16_t address);
+    bool protect(bool executable);
+
+    Block blocks[4096];
+    // Never writable and executable at once: it is read/write while blocks are
+    // emitted and switched to read/execute before one runs
+    uint8_t *buffer;
+    size_t used;
+    bool executable;
+};
+
+}
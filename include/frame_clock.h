@@ -0,0 +1,43 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#include "machine.h"
+
+namespace chip8{
+
+// Fixed timestep clock. Deadlines are computed from the start time and the
+// tick count (start + n / hz) instead of adding a rounded period every frame,
+// so a long run stays at exactly `hz` ticks per second without drifting.
+class FrameClock{
+public:
+    using clock = std::chrono::steady_clock;
+
+    // Ticks that can be caught up in one go before the clock gives up and resyncs (e.g. after the window was dragged)
+    static constexpr uint32_t max_catch_up = 5;
+
+    explicit FrameClock(uint32_t hz = TIMER_HZ);
+
+    void start();
+
+    // The absolute time the next tick is due at
+    clock::time_point deadline() const;
+
+    // Accounts for the time that passed since the last call and returns how many
+    // ticks are due, at most max_catch_up. Ticks beyond that are dropped
+    uint32_t advance();
+
+    uint64_t ticks() const;
+    uint64_t droppedTicks() const;
+
+private:
+    clock::time_point tickTime(uint64_t tick) const;
+
+    uint32_t hz;
+    clock::time_point origin;
+    uint64_t tick_count;
+    uint64_t dropped;
+};
+
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <SDL2/SDL.h>
+#include <cstdint>
+#include <string>
+
+namespace chip8{
+
+// Which keypad key (0-F) every SDL scancode presses. Scancodes are positions
+// on the keyboard, so a layout works the same whatever language it is set to
+struct Keymap{
+    static constexpr uint8_t unbound = 0xFF;
+
+    uint8_t keys[SDL_NUM_SCANCODES];
+
+    // Starts with the 'hex' layout
+    Keymap();
+
+    // Replaces every binding with a named layout:
+    //   hex     keys 0-9 and A-F press the keypad key they are named after
+    //   qwerty  the 4x4 block 1234/QWER/ASDF/ZXCV laid out like the COSMAC VIP keypad
+    // Returns false for unknown names
+    bool setLayout(const std::string &name);
+    // Binds the scancode called `scancode_name` by SDL (e.g. "Space", "Left Shift") to `key`, unbound removes it
+    bool bind(const std::string &scancode_name, uint8_t key);
+
+    uint8_t lookup(SDL_Scancode scancode) const {
+        return ((unsigned)scancode < SDL_NUM_SCANCODES ? keys[scancode] : unbound);
+    }
+};
+
+}
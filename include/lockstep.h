@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+
+#include "machine.h"
+
+namespace chip8{
+
+// Runs `Lanes` copies of one program side by side, e.g. the same ROM with
+// different seeds or inputs for fuzzing and search. The state is kept as
+// structure-of-arrays, one array per register holding that register for every
+// lane. While every lane is at the same pc the instruction is decoded once and
+// executed for all lanes by loops over those arrays, which the compiler turns
+// into SIMD code (AVX2 on CPUs that have it when built with CHIP8_AVX2). Lanes that are halted or
+// wait for a key sit out and leave the rest running together, lanes whose pc
+// differs are stepped one by one until they meet again.
+// Each lane behaves exactly like a Machine driven with step(), with strict mode off
+template <int Lanes>
+class Lockstep{
+    static_assert(Lanes == 8 || Lanes == 16 || Lanes == 32, "Lockstep runs 8, 16 or 32 lanes");
+
+public:
+    // Every lane starts as a copy of `machine`. The object is large, allocate it on the heap
+    explicit Lockstep(const Machine &machine);
+
+    void seed(int lane, uint32_t value);
+    // Sets a lane's keypad, bit n is key n. A key going down ends FX0A like Machine::setKeys()
+    void setKeys(int lane, uint16_t mask);
+
+    // Runs `cycles` instructions on every lane that is not halted or waiting for a key
+    void run(uint64_t cycles);
+    // Counts every lane's timers down by one, once per 60 Hz tick
+    void tickTimers();
+
+    // Copies a lane into `machine`, e.g. to look at it or keep running it alone
+    void store(int lane, Machine &machine) const;
+
+    bool halted(int lane) const;
+    bool waitingForKey(int lane) const;
+
+    // Instructions executed for all lanes at once and for a single lane
+    uint64_t lockstepSteps() const;
+    uint64_t scalarSteps() const;
+
+    alignas(32) unsigned char V[16][Lanes];
+    alignas(32) uint16_t I[Lanes];
+    alignas(32) uint16_t pc[Lanes];
+    alignas(32) uint16_t stack[16][Lanes];
+    alignas(32) uint8_t sp[Lanes];
+    alignas(32) uint8_t delay_timer[Lanes];
+    alignas(32) uint8_t audio_timer[Lanes];
+    alignas(32) uint32_t rng_state[Lanes];
+    alignas(32) uint16_t keys[Lanes];
+    alignas(32) uint64_t display[SCREEN_HEIGHT][Lanes];
+    alignas(32) uint32_t dirty_rows[Lanes];
+    unsigned char memory[Lanes][4096];
+
+private:
+    // Runs `instruction` (pc already moved past it) for every lane, or only for `lane` when not
+    // Uniform. Masked leaves the lanes that are not active untouched
+    template <bool Uniform, bool Masked>
+    void execute(uint16_t instruction, int lane);
+    // execute() for every lane, through executeAvx2() when the CPU and the build allow it
+    template <bool Masked>
+    void executeAll(uint16_t instruction);
+    template <bool Masked>
+    void executeAvx2(uint16_t instruction);
+    uint16_t instructionAt(int lane) const;
+    bool converged(int &lead);
+    void draw(int lane, uint8_t X, uint8_t Y, uint8_t N);
+
+    bool key_wait[Lanes];
+    uint8_t key_wait_reg[Lanes];
+    bool is_halted[Lanes];
+    bool use_avx2;
+    // Lanes that can run, as of the last converged()
+    bool active[Lanes];
+    bool all_active;
+
+    // No lane wrote anything to memory the others did not, so lane 0's instruction is everyone's
+    bool shared_memory;
+    uint64_t lockstep_steps;
+    uint64_t scalar_steps;
+};
+
+extern template class Lockstep<8>;
+extern template class Lockstep<16>;
+extern template class Lockstep<32>;
+
+}
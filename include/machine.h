@@ -0,0 +1,197 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define SCREEN_WIDTH 64
+#define SCREEN_HEIGHT 32
+
+#define TIMER_HZ 60
+
+static_assert(SCREEN_WIDTH == 64, "display rows are stored in 64-bit words");
+static_assert(SCREEN_HEIGHT <= 32, "dirty_rows has one bit per row");
+
+namespace chip8{
+
+class Dynarec;
+struct Snapshot;
+class Machine;
+
+// Every instruction the interpreter knows, in the order of the dispatch tables
+#define CHIP8_OPS(X) \
+    X(nop) X(cls) X(ret) X(jp) X(call) \
+    X(se_vx_nn) X(sne_vx_nn) X(se_vx_vy) X(ld_vx_nn) X(add_vx_nn) \
+    X(ld_vx_vy) X(or_vx_vy) X(and_vx_vy) X(xor_vx_vy) X(add_vx_vy) \
+    X(sub_vx_vy) X(shr_vx) X(subn_vx_vy) X(shl_vx) X(sne_vx_vy) \
+    X(ld_i_nnn) X(jp_v0) X(rnd) X(drw) X(skp) X(sknp) \
+    X(ld_vx_dt) X(ld_vx_k) X(ld_dt_vx) X(ld_st_vx) X(add_i_vx) \
+    X(ld_f_vx) X(ld_b_vx) X(ld_mem_vx) X(ld_vx_mem) \
+    X(ld_ld_drw) X(se_jp) X(dt_se_jp) \
+    X(invalid)
+
+enum class Op : uint8_t {
+#define CHIP8_ENUM(name) name,
+    CHIP8_OPS(CHIP8_ENUM)
+#undef CHIP8_ENUM
+};
+
+// An instruction split into the function that runs it and its operands. The
+// machine keeps one per address so the hot loop decodes every instruction once.
+// Common sequences are fused into a single superinstruction (see decodeAt)
+struct Decoded {
+    using Handler = void (*)(Machine &machine, const Decoded &op);
+
+    Handler handler;
+    uint16_t nnn;
+    uint16_t aux;   // operand taken from a fused instruction, the whole instruction for Op::invalid
+    uint8_t x;
+    uint8_t y;
+    uint8_t n;
+    uint8_t nn;
+    Op op;
+    uint8_t length; // instructions covered, more than 1 for superinstructions
+};
+
+// An 8-bit register counting down to 0 at TIMER_HZ. It has no clock of its own,
+// it only moves when the scheduler ticks it, so runs are reproducible
+struct timer_base {
+    uint8_t reg = 0;
+
+    uint8_t get() const {
+        return reg;
+    }
+    void set(uint8_t value) {
+        reg = value;
+    }
+    // Counts down `ticks` TIMER_HZ ticks at once, stopping at 0
+    void tick(uint32_t ticks = 1) {
+        reg = (reg > ticks ? reg - ticks : 0);
+    }
+};
+
+// A single CHIP-8 machine. It owns all of its state (registers, memory,
+// framebuffer, keypad, timers) and does not know about SDL, so any number of
+// them can live in one process and be driven without a window.
+class Machine{
+public:
+    static constexpr uint16_t sprite_offset = 0x000;
+    static constexpr uint16_t mem_offset = 0x200;
+
+    Machine();
+    ~Machine();
+
+    void reset();
+    void seed(uint32_t value);
+    bool loadRom(const std::string &path);
+    bool loadRom(const unsigned char *data, size_t size);
+
+    // Copies the whole machine state into `snapshot`
+    void save(Snapshot &snapshot) const;
+    // Puts the machine back into a saved state. Returns false (and changes nothing)
+    // if `snapshot` is from another version
+    bool load(const Snapshot &snapshot);
+
+    // Executes a single instruction
+    void step();
+    // Executes up to `cycles` instructions, stops early if the machine halts
+    // or starts waiting for a key. Returns how many were executed. When the
+    // program spins in a loop only a timer tick or a key press can end (see
+    // idle()) the rest of the cycles are skipped and counted as executed
+    uint64_t run(uint64_t cycles);
+    // Counts the delay and sound timers down by `ticks`, the scheduler calls this once per 60 Hz tick
+    void tickTimers(uint32_t ticks = 1);
+
+    // A key going down while the machine waits in FX0A stores it in VX and lets the program continue
+    void setKey(unsigned int key, bool pressed);
+    // Sets the whole keypad at once, bit n is key n. Keys going down end FX0A like setKey() does.
+    // `pressed` adds presses that happened since the last call but are already over, which
+    // count as keys going down even though they are not in `mask` any more
+    void setKeys(uint16_t mask, uint16_t pressed = 0);
+    uint16_t keyMask() const;
+    bool getKeyState(unsigned int key) const {
+        return key <= 0xF && ((keys >> key) & 1);
+    }
+    // True while FX0A waits for a key press. run() executes nothing then but the timers keep ticking
+    bool waitingForKey() const;
+
+    bool halted() const;
+    // True when the last run() or step() stopped in an idle loop
+    bool idle() const;
+    // How many instructions idle loops have skipped since the last reset
+    uint64_t idleCycles() const;
+    // The opcode that halted the machine, 0 if it stopped on a return from the top level
+    uint16_t haltInstruction() const;
+    bool soundActive() const;
+
+    // Must be called after writing to `memory` from outside the machine so cached instructions are decoded again
+    void flushCache();
+
+    // Runs straight-line code through the x86-64 dynamic recompiler. Returns false
+    // (and keeps interpreting) when this build does not have it
+    bool setDynarec(bool enabled);
+    bool dynarecEnabled() const;
+
+    // Off by default: opcodes that are not CHIP-8 instructions (8XYN, EXNN and FXNN
+    // outside the known set) are skipped like 0NNN. When on they halt the machine
+    // and haltInstruction() tells which one it was, for tools that check ROMs
+    void setStrict(bool enabled);
+    bool strict() const;
+
+    // Bit n is set when row n of the framebuffer changed, the frontend clears it once it has drawn those rows
+    uint32_t dirty_rows;
+    // One word per row, bit 63 is the leftmost pixel
+    uint64_t display[SCREEN_HEIGHT];
+
+    bool pixel(int x, int y) const {
+        return (display[y] >> (SCREEN_WIDTH - 1 - x)) & 1;
+    }
+
+    unsigned char V[16];
+    uint16_t I;
+    uint16_t pc;
+    uint16_t stack[16];
+    uint8_t sp;
+
+    unsigned char memory[4096];
+
+    timer_base delay_timer;
+    timer_base audio_timer;
+
+private:
+    friend struct Ops;
+    template <int Lanes> friend class Lockstep;
+
+    const Decoded &fetch();
+    uint16_t instructionAt(uint16_t address) const;
+    static Decoded decode(uint16_t instruction);
+    Decoded decodeAt(uint16_t address) const;
+    uint64_t runDynarec(uint64_t cycles);
+    void invalidate(uint16_t address, uint16_t length);
+    void skipIdle(uint16_t start, uint8_t length);
+    void OC_DXYN(uint8_t X, uint8_t Y, uint8_t N);
+    unsigned char random();
+
+    std::vector<Decoded> icache;
+    Decoded unfused;
+    // Instructions the current run() may still execute, superinstructions take their extra ones from it too
+    uint64_t budget;
+    std::unique_ptr<Dynarec> dynarec;
+
+    uint16_t keys; // bit n is key n
+    bool key_wait;
+    unsigned char key_wait_reg;
+
+    bool is_halted;
+    uint16_t halt_instruction;
+    bool is_strict;
+
+    bool is_idle;
+    uint64_t idle_cycles;
+
+    uint32_t rng_state;
+};
+
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "snapshot.h"
+
+namespace chip8{
+
+// The last few seconds of a Machine, one snapshot per frame, for rewinding.
+// Every keyframe_interval-th frame is kept whole, the frames after it only as
+// the words that differ from it (XOR against the keyframe, runs of unchanged
+// words left out), so a minute of a typical game takes around a megabyte.
+// The ring holds a fixed number of frames and reuses their storage once it is
+// full, capturing a frame costs about a microsecond and allocates nothing after
+// the first lap
+class Rewind{
+public:
+    static constexpr uint32_t keyframe_interval = 60;
+
+    // `frames` is rounded up to a whole number of keyframe intervals
+    explicit Rewind(uint32_t frames);
+
+    // Stores the machine's state as the newest frame, dropping the oldest one if the ring is full
+    void push(const Machine &machine);
+    // Puts the machine back to the newest frame and drops it. Returns false when there is nothing left
+    bool pop(Machine &machine);
+    void clear();
+
+    // Frames that can be rewound to, the frames of a keyframe that was already overwritten no longer count
+    uint32_t size() const;
+    uint32_t capacity() const;
+    // Memory held for the frames
+    size_t bytes() const;
+
+private:
+    static constexpr size_t words = sizeof(Snapshot) / sizeof(uint64_t);
+    static_assert(sizeof(Snapshot) % sizeof(uint64_t) == 0, "Snapshots are compared a word at a time");
+
+    // A keyframe is `words` words. A delta is a list of runs, each a header word
+    // (unchanged words to skip in the low half, changed words that follow in the
+    // high half) and then the changed words XORed with the keyframe
+    std::vector<uint64_t> &slot(uint64_t frame);
+    uint64_t oldest() const;
+
+    std::vector<std::vector<uint64_t>> slots;
+    uint64_t head = 0;      // number of the next frame to be pushed, frames are numbered from 0 on
+    uint64_t tail = 0;      // oldest frame still stored
+    Snapshot current;       // the frame being captured or restored
+};
+
+}
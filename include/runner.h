@@ -0,0 +1,45 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "machine.h"
+
+namespace chip8{
+
+// Holds keypad key `key` down for `frames` frames starting at frame `frame`
+struct KeyPress {
+    uint64_t frame;
+    uint8_t key;
+    uint64_t frames = 1;
+};
+
+struct RunOptions {
+    uint64_t frames = 600;
+    uint32_t instructions_per_second = 700;
+    uint32_t seed = 1;
+    bool dynarec = false;
+    std::vector<KeyPress> input;
+};
+
+struct RunResult {
+    uint64_t frames = 0;        // frames actually run, fewer than asked if the machine halted
+    uint64_t instructions = 0;
+    uint64_t framebuffer_hash = 0;
+    std::chrono::nanoseconds wall{0};
+};
+
+// Parses "frame:key[:frames]" with the key in hex, e.g. "120:5:30"
+bool parseKeyPress(const std::string &text, KeyPress &press);
+
+// FNV-1a of the framebuffer rows, equal framebuffers give equal hashes
+uint64_t framebufferHash(const Machine &machine);
+
+// Runs a loaded machine for `options.frames` 60 Hz frames as fast as possible,
+// playing the scripted input. Each frame runs the scheduler for one tick, so
+// the result only depends on the ROM and the options
+RunResult runFrames(Machine &machine, const RunOptions &options);
+
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#include "machine.h"
+
+namespace chip8{
+
+// Splits the instruction rate into TIMER_HZ ticks. Every tick runs the
+// instructions that belong to it and then counts the timers down once, the
+// frontend presents the frame after each tick.
+class Scheduler{
+public:
+    // Passed as the instruction rate to run as many instructions as fit in a tick
+    static constexpr uint32_t unlimited = 0;
+
+    explicit Scheduler(Machine &machine, uint32_t instructions_per_second = 700);
+
+    void setInstructionsPerSecond(uint32_t instructions_per_second);
+    uint32_t instructionsPerSecond() const;
+
+    // Runs one tick. In unlimited mode instructions are executed until `deadline`
+    // Returns how many instructions were executed
+    uint64_t tick(std::chrono::steady_clock::time_point deadline);
+    // Catches up ticks the host had no time for: the timers count them down but
+    // their instructions are not run, so the timers stay in step with real time
+    void skip(uint64_t ticks);
+
+private:
+    Machine &machine;
+    uint32_t rate;
+    uint32_t remainder; // rate % TIMER_HZ carried between ticks so e.g. 700 Hz does not round down to 660 Hz
+};
+
+}
@@ -1,23 +1,24 @@
 #pragma once
 
 #include <SDL2/SDL.h>
-#include <map>
+#include <atomic>
+#include <chrono>
 
-#define SCREEN_WIDTH 64
-#define SCREEN_HEIGHT 32
-
-extern bool screen[SCREEN_HEIGHT][SCREEN_WIDTH];
+#include "keymap.h"
+#include "machine.h"
 
 extern int current_screen_width;
 extern int current_screen_height;
 
 extern SDL_Window *window;
-extern SDL_Surface *surface;
+extern SDL_Renderer *renderer;
+extern SDL_Texture *texture;
 extern SDL_Event event;
 
 int handleEventsInternal(void *userdata, SDL_Event *event);
 
-extern std::map<unsigned char, bool> key_pressed;
+// Keypad state written by the event watch, bit n is set while key n is held
+extern std::atomic<uint16_t> key_pressed;
 
 namespace chip8{
 
@@ -25,16 +26,27 @@ class Screen{
 public:
     Screen();
 
+    // Which keyboard keys press which keypad keys, the default is the 'hex' layout
+    void setKeymap(const Keymap &map);
+    // The key that rewinds while it is held, SDL_SCANCODE_UNKNOWN for none
+    void setRewindKey(SDL_Scancode scancode);
+    bool rewindHeld();
     bool getKeyState(unsigned int key);
-    unsigned char awaitKeyPress();
+    // The whole keypad in one load, safe to call from any thread
+    uint16_t keyMask();
+    // Keys that went down since the last call, also the ones already released again, so a
+    // tap shorter than a tick still reaches FX0A. Safe to call from any thread
+    uint16_t takePresses();
     void handleEvents();
+    // Sleeps in SDL until `deadline`, the event watch handles the events that arrive meanwhile
+    void waitEvents(std::chrono::steady_clock::time_point deadline);
     bool closed();
 
 
-    void drawPixel(int x, int y);
-    void erasePixel(int x, int y);
-    void clear();
+    // Re-rasterizes the rows set in `dirty_rows`, uploads the range they span into the streaming texture and presents it, call once per frame
+    void draw(const uint64_t display[SCREEN_HEIGHT], uint32_t dirty_rows);
 private:
+    Uint32 pixels[SCREEN_HEIGHT][SCREEN_WIDTH];
 
 };
 
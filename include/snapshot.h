@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <type_traits>
+
+#include "machine.h"
+
+namespace chip8{
+
+// The complete state of a Machine as plain data, taken with Machine::save() and
+// put back with Machine::load(). Both are straight copies, so snapshots are cheap
+// enough to take every frame. The file format is this struct as it is in memory
+// (host byte order), `version` changes whenever the layout does
+struct Snapshot {
+    static constexpr uint32_t magic_value = 0x38504843; // "CHP8"
+    static constexpr uint32_t current_version = 1;
+
+    uint32_t magic = magic_value;
+    uint32_t version = current_version;
+
+    unsigned char memory[4096];
+    uint64_t display[SCREEN_HEIGHT];
+    uint16_t stack[16];
+    unsigned char V[16];
+    uint16_t I;
+    uint16_t pc;
+    uint8_t sp;
+    uint8_t delay_timer;
+    uint8_t audio_timer;
+    uint8_t key_wait;       // FX0A is waiting, the key goes to V[key_wait_reg]
+    uint8_t key_wait_reg;
+    uint8_t halted;
+    uint16_t keys;          // bit n is key n
+    uint16_t halt_instruction;
+    uint16_t reserved = 0;      // always 0, spelled out so the struct has no padding that could hold garbage
+    uint32_t rng_state;
+    uint32_t reserved_end = 0;  // same, pads the struct to a multiple of 8 bytes
+};
+
+static_assert(std::is_trivially_copyable<Snapshot>::value, "Snapshot is saved and loaded with plain copies");
+static_assert(std::has_unique_object_representations<Snapshot>::value, "Snapshot must not have implicit padding");
+static_assert(sizeof(Snapshot) == 4432, "The file format is the struct, changing its layout needs a new version");
+
+// Returns false if the file cannot be written
+bool saveSnapshot(const Snapshot &snapshot, const std::string &path);
+// Returns false if the file cannot be read or is not a snapshot of the current version
+bool loadSnapshot(const std::string &path, Snapshot &snapshot);
+
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+namespace chip8{
+
+// Fixed size queue between exactly one producer thread and one consumer thread.
+// Neither side ever locks or waits: push() fails when the ring is full and pop()
+// when it is empty, the caller decides what that means
+template <typename T, size_t Capacity>
+class SpscRing{
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    // Producer side
+    bool push(const T &value) {
+        size_t tail = write_index.load(std::memory_order_relaxed);
+        if (tail - read_index.load(std::memory_order_acquire) == Capacity) return false;
+        items[tail & (Capacity - 1)] = value;
+        write_index.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side
+    bool pop(T &value) {
+        size_t head = read_index.load(std::memory_order_relaxed);
+        if (head == write_index.load(std::memory_order_acquire)) return false;
+        value = items[head & (Capacity - 1)];
+        read_index.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Only exact when called from one of the two threads while the other one is idle
+    size_t size() const {
+        return write_index.load(std::memory_order_acquire) - read_index.load(std::memory_order_acquire);
+    }
+
+private:
+    T items[Capacity];
+    // On separate cache lines so the two threads do not keep stealing each other's line
+    alignas(64) std::atomic<size_t> write_index{0};
+    alignas(64) std::atomic<size_t> read_index{0};
+};
+
+}
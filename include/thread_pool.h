@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace chip8{
+
+// Fixed set of worker threads, each with its own job queue. Jobs are dealt out
+// round robin, a worker runs its own queue newest first and when it runs dry
+// steals the oldest jobs of the others, so uneven jobs still keep every core busy.
+// Busy workers only ever lock the queue they take from, the shared lock is for
+// sleeping when every queue is empty and for waking up again
+class ThreadPool{
+public:
+    // 0 uses one thread per hardware thread
+    explicit ThreadPool(unsigned threads = 0);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    void submit(std::function<void()> job);
+    // Blocks until every submitted job has finished
+    void wait();
+
+    unsigned size() const;
+
+private:
+    struct Queue {
+        std::mutex lock;
+        std::deque<std::function<void()>> jobs;
+    };
+
+    void work(unsigned index);
+    bool take(unsigned index, std::function<void()> &job);
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+
+    std::mutex state_lock;
+    std::condition_variable wake;   // a job was queued or the pool is stopping
+    std::condition_variable idle;   // the last pending job finished
+    std::atomic<size_t> queued;     // jobs sitting in the queues
+    std::atomic<size_t> pending;    // jobs submitted and not finished
+    std::atomic<unsigned> next;     // queue the next job goes to
+    std::atomic<unsigned> sleepers; // workers waiting on `wake`
+    bool stopping;                  // guarded by state_lock
+};
+
+}
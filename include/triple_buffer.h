@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace chip8{
+
+// Hands values from one writer thread to one reader thread without locks. The
+// writer fills back() and publishes it, the reader picks up the newest published
+// value with update(). Neither side ever waits, values the reader was too slow
+// for are skipped
+template <typename T>
+class TripleBuffer{
+public:
+    // Writer side
+    T &back() {
+        return slots[back_index];
+    }
+    // Returns true when the value published before this one was skipped, the reader never saw it
+    bool publish() {
+        uint8_t old = middle.exchange(back_index | fresh, std::memory_order_acq_rel);
+        back_index = old & index_mask;
+        return (old & fresh) != 0;
+    }
+
+    // Reader side. Returns true and moves front() to the newest value if one was published since the last call
+    bool update() {
+        if ((middle.load(std::memory_order_relaxed) & fresh) == 0) return false;
+        uint8_t old = middle.exchange(front_index, std::memory_order_acq_rel);
+        front_index = old & index_mask;
+        return true;
+    }
+    const T &front() const {
+        return slots[front_index];
+    }
+
+private:
+    static constexpr uint8_t index_mask = 3;
+    static constexpr uint8_t fresh = 4; // set in `middle` when it holds a value the reader has not seen
+
+    T slots[3] = {};
+    alignas(64) std::atomic<uint8_t> middle{1};
+    alignas(64) uint8_t back_index = 0;     // only used by the writer
+    alignas(64) uint8_t front_index = 2;    // only used by the reader
+};
+
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace chip8{
+
+struct WaiterStats {
+    uint64_t waits = 0;
+    std::chrono::nanoseconds slept{0};     // time spent blocked in the OS
+    std::chrono::nanoseconds spun{0};      // time spent burning the CPU
+    std::chrono::nanoseconds overshoot{0}; // how late the waits returned in total
+};
+
+// Blocks the calling thread until a deadline. How it does so can be changed at
+// runtime, every instance keeps its own estimate and counters.
+class Waiter{
+public:
+    using clock = std::chrono::steady_clock;
+
+    enum class Mode {
+        sleep,     // Only sleeps, cheapest but the OS may wake us up late
+        hybrid,    // Sleeps until shortly before the deadline, then yields until it is reached
+        nanosleep, // clock_nanosleep with an absolute deadline (falls back to hybrid where it is missing)
+        busy       // Spins, most precise and uses a whole core
+    };
+
+    explicit Waiter(Mode mode = Mode::hybrid);
+
+    void setMode(Mode mode);
+    Mode mode() const;
+    static bool modeFromName(const std::string &name, Mode &mode);
+
+    void waitUntil(clock::time_point deadline);
+
+    const WaiterStats &stats() const;
+    void resetStats();
+
+private:
+    void sleepUntil(clock::time_point deadline);
+    void spinUntil(clock::time_point deadline);
+    void hybridWait(clock::time_point deadline);
+    void nanosleepUntil(clock::time_point deadline);
+
+    Mode current;
+    WaiterStats counters;
+
+    // Welford estimate of how late the OS wakes us up, used by the hybrid mode
+    double estimate;
+    double mean;
+    double m2;
+    int64_t count;
+};
+
+}
@@ -0,0 +1,82 @@
+#include "audio.h"
+
+#include <algorithm>
+
+namespace chip8{
+
+Audio::Audio(uint32_t pitch, uint32_t volume) : device(0), underrun_count(0), overrun_count(0), prefill_left(prefill_ticks), sound_timer(0), playing(false), tick_left(0), phase(0) {
+    phase_step = (uint32_t)(((uint64_t)std::min<uint32_t>(pitch, sample_rate / 2) << 32) / sample_rate);
+    amplitude = (int16_t)(std::min<uint32_t>(volume, 100) * 0x7FFF / 100);
+
+    SDL_AudioSpec wanted;
+    SDL_zero(wanted);
+    wanted.freq = sample_rate;
+    wanted.format = AUDIO_S16SYS;
+    wanted.channels = 1;
+    wanted.samples = 512;
+    wanted.callback = callback;
+    wanted.userdata = this;
+
+    // SDL converts from this format if the device wants another one. It stays paused until queueTick() has filled the queue a bit
+    device = SDL_OpenAudioDevice(NULL, 0, &wanted, NULL, 0);
+}
+
+Audio::~Audio() {
+    if (device != 0) SDL_CloseAudioDevice(device);
+}
+
+bool Audio::opened() const {
+    return device != 0;
+}
+
+void Audio::queueTick(uint8_t sound_timer) {
+    if (device == 0) return;
+    if (!ticks.push(sound_timer))
+        overrun_count.fetch_add(1, std::memory_order_relaxed);
+    if (prefill_left > 0 && --prefill_left == 0) SDL_PauseAudioDevice(device, 0);
+}
+
+uint64_t Audio::underruns() const {
+    return underrun_count.load(std::memory_order_relaxed);
+}
+
+uint64_t Audio::overruns() const {
+    return overrun_count.load(std::memory_order_relaxed);
+}
+
+void SDLCALL Audio::callback(void *userdata, Uint8 *stream, int length) {
+    Audio &audio = *static_cast<Audio *>(userdata);
+    int16_t *samples = reinterpret_cast<int16_t *>(stream);
+    int count = length / (int)sizeof(int16_t);
+
+    int i = 0;
+    while (i < count) {
+        if (audio.tick_left == 0) {
+            if (!audio.ticks.pop(audio.sound_timer)) {
+                // The emulation is behind (or stopped, or dropped ticks it could not catch up on). Count the
+                // timer down as it would have gone, so a beep does not get a gap but cannot get stuck either
+                audio.sound_timer -= (audio.sound_timer > 0);
+                audio.underrun_count.fetch_add(1, std::memory_order_relaxed);
+            }
+            audio.playing = (audio.sound_timer != 0);
+            // Restart the wave on the next beep so it always begins the same way
+            if (!audio.playing) audio.phase = 0;
+            audio.tick_left = samples_per_tick;
+        }
+
+        int span = std::min(count - i, audio.tick_left);
+        if (audio.playing) {
+            for (int k = i; k < i + span; k++) {
+                samples[k] = (audio.phase < 0x80000000u ? audio.amplitude : -audio.amplitude);
+                audio.phase += audio.phase_step;
+            }
+        }
+        else {
+            std::fill(samples + i, samples + i + span, 0);
+        }
+        i += span;
+        audio.tick_left -= span;
+    }
+}
+
+}
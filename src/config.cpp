@@ -0,0 +1,86 @@
+#include "config.h"
+
+#include <cstdlib>
+#include <fstream>
+
+namespace chip8{
+
+static std::string trim(const std::string &text) {
+    size_t first = text.find_first_not_of(" \t\r");
+    if (first == std::string::npos) return "";
+    size_t last = text.find_last_not_of(" \t\r");
+    return text.substr(first, last - first + 1);
+}
+
+bool Config::load(const std::string &path) {
+    std::ifstream fin(path);
+    if (!fin.is_open()) return false;
+
+    std::getline(fin, rom);
+    if (!rom.empty() && rom.back() == '\r') rom.pop_back();
+
+    std::string line;
+    bool applies = true;
+    while (std::getline(fin, line)) {
+        line = trim(line);
+        if (line.empty() || line[0] == '#') continue;
+
+        // A ROM's own section, ROM names may contain brackets themselves so only the outer ones count
+        if (line.front() == '[' && line.back() == ']') {
+            applies = (line.substr(1, line.size() - 2) == rom);
+            continue;
+        }
+        if (!applies) continue;
+
+        size_t equals = line.find('=');
+        if (equals == std::string::npos) continue;
+        std::string key = trim(line.substr(0, equals));
+        std::string value = trim(line.substr(equals + 1));
+
+        if (key == "cpu_hz") {
+            char *end = nullptr;
+            unsigned long hz = std::strtoul(value.c_str(), &end, 10);
+            if (value == "unlimited") instructions_per_second = 0;
+            else if (end != value.c_str() && *end == '\0' && hz > 0) instructions_per_second = hz;
+        }
+        else if (key == "waiter") {
+            Waiter::modeFromName(value, wait_mode);
+        }
+        else if (key == "dynarec") {
+            dynarec = (value == "on");
+        }
+        else if (key == "tone_hz") {
+            char *end = nullptr;
+            unsigned long hz = std::strtoul(value.c_str(), &end, 10);
+            if (end != value.c_str() && *end == '\0' && hz > 0) tone_hz = hz;
+        }
+        else if (key == "volume") {
+            char *end = nullptr;
+            unsigned long percent = std::strtoul(value.c_str(), &end, 10);
+            if (end != value.c_str() && *end == '\0' && percent <= 100) volume = percent;
+        }
+        else if (key == "layout") {
+            keymap.setLayout(value);
+        }
+        else if (key == "rewind") {
+            char *end = nullptr;
+            unsigned long seconds = std::strtoul(value.c_str(), &end, 10);
+            if (value == "off") rewind_seconds = 0;
+            else if (end != value.c_str() && *end == '\0' && seconds <= 600) rewind_seconds = seconds;
+        }
+        else if (key == "rewind_key") {
+            SDL_Scancode scancode = SDL_GetScancodeFromName(value.c_str());
+            if (value == "none") rewind_key = SDL_SCANCODE_UNKNOWN;
+            else if (scancode != SDL_SCANCODE_UNKNOWN) rewind_key = scancode;
+        }
+        else if (key.compare(0, 4, "key.") == 0) {
+            char *end = nullptr;
+            unsigned long pad = std::strtoul(value.c_str(), &end, 16);
+            if (value == "none") keymap.bind(key.substr(4), Keymap::unbound);
+            else if (end != value.c_str() && *end == '\0' && pad <= 0xF) keymap.bind(key.substr(4), (uint8_t)pad);
+        }
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,264 @@
+#include "dynarec.h"
+
+#include <cstring>
+
+#include "machine.h"
+
+#if defined(CHIP8_DYNAREC) && defined(__x86_64__) && defined(__linux__)
+#define CHIP8_DYNAREC_X64 1
+#include <sys/mman.h>
+#endif
+
+namespace chip8{
+
+#if CHIP8_DYNAREC_X64
+
+// Register use of the generated code (System V calling convention):
+//   rdi = V, rsi = &I, rdx = memory, eax and ecx are scratch
+struct Emitter {
+    uint8_t *out;
+    size_t pos;
+    size_t capacity;
+
+    bool full() const {
+        return pos > capacity;
+    }
+    void bytes(std::initializer_list<uint8_t> list) {
+        for (uint8_t b : list) {
+            if (pos < capacity) out[pos] = b;
+            pos++;
+        }
+    }
+    void imm32(uint32_t value) {
+        bytes({ (uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24) });
+    }
+
+    void loadV(uint8_t x) { bytes({ 0x0F, 0xB6, 0x47, x }); }        // movzx eax, byte [rdi + x]
+    void storeV(uint8_t x) { bytes({ 0x88, 0x47, x }); }             // mov [rdi + x], al
+    void storeFlag() { storeV(0xF); }
+};
+
+// Emits `instruction` and returns true, or returns false if it has to be left to the interpreter
+static bool emit(Emitter &e, uint16_t instruction) {
+    uint8_t x = (instruction & 0x0F00) >> 8;
+    uint8_t y = (instruction & 0x00F0) >> 4;
+    uint8_t nn = instruction & 0x00FF;
+    uint16_t nnn = instruction & 0x0FFF;
+
+    switch (instruction & 0xF000)
+    {
+    case 0x6000: // 6XNN
+        e.bytes({ 0xC6, 0x47, x, nn });                 // mov byte [rdi + x], nn
+        return true;
+    case 0x7000: // 7XNN
+        e.bytes({ 0x80, 0x47, x, nn });                 // add byte [rdi + x], nn
+        return true;
+    case 0x8000:
+        // The flag is written before the result like in the interpreter, so X or Y being F behaves the same
+        switch (instruction & 0x000F)
+        {
+        case 0x0: // 8XY0
+            e.loadV(y);
+            e.storeV(x);
+            return true;
+        case 0x1: // 8XY1
+            e.loadV(y);
+            e.bytes({ 0x08, 0x47, x });                 // or [rdi + x], al
+            return true;
+        case 0x2: // 8XY2
+            e.loadV(y);
+            e.bytes({ 0x20, 0x47, x });                 // and [rdi + x], al
+            return true;
+        case 0x3: // 8XY3
+            e.loadV(y);
+            e.bytes({ 0x30, 0x47, x });                 // xor [rdi + x], al
+            return true;
+        case 0x4: // 8XY4
+            e.loadV(x);
+            e.bytes({ 0x0F, 0xB6, 0x4F, y });           // movzx ecx, byte [rdi + y]
+            e.bytes({ 0x01, 0xC8 });                    // add eax, ecx
+            e.bytes({ 0xC1, 0xE8, 0x08 });              // shr eax, 8
+            e.storeFlag();
+            e.loadV(x);
+            e.bytes({ 0x02, 0x47, y });                 // add al, [rdi + y]
+            e.storeV(x);
+            return true;
+        case 0x5: // 8XY5
+            e.loadV(x);
+            e.bytes({ 0x3A, 0x47, y });                 // cmp al, [rdi + y]
+            e.bytes({ 0x0F, 0x93, 0xC0 });              // setae al
+            e.storeFlag();
+            e.loadV(x);
+            e.bytes({ 0x2A, 0x47, y });                 // sub al, [rdi + y]
+            e.storeV(x);
+            return true;
+        case 0x6: // 8XY6
+            e.loadV(x);
+            e.bytes({ 0x83, 0xE0, 0x01 });              // and eax, 1
+            e.storeFlag();
+            e.bytes({ 0xD0, 0x6F, x });                 // shr byte [rdi + x], 1
+            return true;
+        case 0x7: // 8XY7
+            e.loadV(y);
+            e.bytes({ 0x3A, 0x47, x });                 // cmp al, [rdi + x]
+            e.bytes({ 0x0F, 0x93, 0xC0 });              // setae al
+            e.storeFlag();
+            e.loadV(y);
+            e.bytes({ 0x2A, 0x47, x });                 // sub al, [rdi + x]
+            e.storeV(x);
+            return true;
+        case 0xE: // 8XYE
+            e.loadV(x);
+            e.bytes({ 0xC1, 0xE8, 0x07 });              // shr eax, 7
+            e.storeFlag();
+            e.bytes({ 0xD0, 0x67, x });                 // shl byte [rdi + x], 1
+            return true;
+        }
+        return false; // the other 8XYN are left to the interpreter, which halts on them in strict mode
+    case 0xA000: // ANNN
+        e.bytes({ 0x66, 0xC7, 0x06, (uint8_t)nnn, (uint8_t)(nnn >> 8) }); // mov word [rsi], nnn
+        return true;
+    case 0xF000:
+        switch (nn)
+        {
+        case 0x1E: // FX1E
+            e.loadV(x);
+            e.bytes({ 0x66, 0x01, 0x06 });              // add [rsi], ax
+            return true;
+        case 0x29: // FX29
+            e.loadV(x);
+            e.bytes({ 0x83, 0xE0, 0x0F });              // and eax, 0xF
+            e.bytes({ 0x8D, 0x04, 0x80 });              // lea eax, [rax + rax * 4]
+            e.bytes({ 0x05 });                          // add eax, sprite_offset
+            e.imm32(Machine::sprite_offset);
+            e.bytes({ 0x66, 0x89, 0x06 });              // mov [rsi], ax
+            return true;
+        case 0x65: // FX65
+            for (uint8_t k = 0; k <= x; k++) {
+                e.bytes({ 0x0F, 0xB7, 0x06 });          // movzx eax, word [rsi]
+                e.bytes({ 0x83, 0xC0, k });             // add eax, k
+                e.bytes({ 0x25 });                      // and eax, 0xFFF
+                e.imm32(0x0FFF);
+                e.bytes({ 0x0F, 0xB6, 0x0C, 0x02 });    // movzx ecx, byte [rdx + rax]
+                e.bytes({ 0x88, 0x4F, k });             // mov [rdi + k], cl
+            }
+            return true;
+        }
+        return false;
+    default:
+        return false;
+    }
+}
+
+bool Dynarec::supported() {
+    return true;
+}
+
+Dynarec::Dynarec() : executable(false) {
+    void *memory = mmap(nullptr, buffer_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    buffer = (memory == MAP_FAILED ? nullptr : static_cast<uint8_t *>(memory));
+    flush();
+}
+
+Dynarec::~Dynarec() {
+    if (buffer != nullptr) munmap(buffer, buffer_size);
+}
+
+// Switches the code buffer between read/write and read/execute. Translating a
+// program's blocks and running them come in long stretches, so this is rare
+bool Dynarec::protect(bool executable) {
+    if (this->executable == executable) return true;
+    if (mprotect(buffer, buffer_size, PROT_READ | (executable ? PROT_EXEC : PROT_WRITE)) != 0) return false;
+    this->executable = executable;
+    return true;
+}
+
+void Dynarec::translate(const Machine &machine, uint16_t address) {
+    Block &block = blocks[address];
+    block.translated = true;
+    block.length = 0;
+    block.code = nullptr;
+    if (buffer == nullptr || !protect(false)) return;
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        Emitter e = { buffer + used, 0, buffer_size - used };
+        uint8_t length = 0;
+        for (uint16_t pc = address; length < max_block && (size_t)pc + 1 < sizeof(machine.memory); pc += 2) {
+            uint16_t instruction = (machine.memory[pc] << 8) | machine.memory[pc + 1];
+            if (!emit(e, instruction)) break;
+            length++;
+        }
+        e.bytes({ 0xC3 }); // ret
+
+        // A single instruction is not worth leaving the interpreter for
+        if (length < 2) return;
+
+        if (e.full()) {
+            // Out of room, start over with an empty buffer
+            flush();
+            blocks[address].translated = true;
+            continue;
+        }
+        block.code = reinterpret_cast<BlockFn>(buffer + used);
+        block.length = length;
+        used += e.pos;
+        return;
+    }
+}
+
+uint64_t Dynarec::execute(Machine &machine, uint64_t budget) {
+    uint16_t address = machine.pc & 0x0FFF;
+    if (!blocks[address].translated) translate(machine, address);
+
+    const Block &block = blocks[address];
+    if (block.length == 0 || block.length > budget || !protect(true)) return 0;
+
+    block.code(machine.V, &machine.I, machine.memory);
+    machine.pc += 2 * block.length;
+    return block.length;
+}
+
+void Dynarec::invalidate(uint16_t address, uint16_t length) {
+    // A block read its instructions plus the one that ended it, at most max_block + 1
+    // instructions, so only blocks starting that far before can reach `address`
+    int first = (int)address - 2 * (max_block + 1);
+    int last = (int)address + length;
+    for (int start = first; start < last; start++) {
+        Block &block = blocks[start & 0x0FFF];
+        if (!block.translated) continue;
+        if (start + 2 * (block.length + 1) > (int)address) block.translated = false;
+    }
+}
+
+void Dynarec::flush() {
+    std::memset(blocks, 0, sizeof(blocks));
+    used = 0;
+}
+
+#else
+
+bool Dynarec::supported() {
+    return false;
+}
+
+Dynarec::Dynarec() : buffer(nullptr), used(0), executable(false) {
+    flush();
+}
+
+Dynarec::~Dynarec() {
+}
+
+uint64_t Dynarec::execute(Machine &, uint64_t) {
+    return 0;
+}
+
+void Dynarec::invalidate(uint16_t, uint16_t) {
+}
+
+void Dynarec::flush() {
+    std::memset(blocks, 0, sizeof(blocks));
+}
+
+#endif
+
+}
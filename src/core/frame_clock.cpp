@@ -0,0 +1,50 @@
+#include "frame_clock.h"
+
+namespace chip8{
+
+FrameClock::FrameClock(uint32_t hz) : hz(hz) {
+    start();
+}
+
+void FrameClock::start() {
+    origin = clock::now();
+    tick_count = 0;
+    dropped = 0;
+}
+
+FrameClock::clock::time_point FrameClock::tickTime(uint64_t tick) const {
+    // Whole seconds and the remainder are kept apart so the nanosecond count never has to be rounded
+    std::chrono::nanoseconds offset = std::chrono::seconds(tick / hz) + std::chrono::nanoseconds((tick % hz) * 1000000000ull / hz);
+    return origin + offset;
+}
+
+FrameClock::clock::time_point FrameClock::deadline() const {
+    return tickTime(tick_count + 1);
+}
+
+uint32_t FrameClock::advance() {
+    int64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - origin).count();
+    uint64_t reached = (uint64_t)elapsed / 1000000000ull * hz + (uint64_t)elapsed % 1000000000ull * hz / 1000000000ull;
+    if (reached <= tick_count) return 0;
+
+    uint64_t due = reached - tick_count;
+    if (due > max_catch_up) {
+        // Shift the origin forward by the skipped ticks so they are not owed anymore
+        uint64_t skipped = due - max_catch_up;
+        origin = tickTime(skipped);
+        dropped += skipped;
+        due = max_catch_up;
+    }
+    tick_count += due;
+    return (uint32_t)due;
+}
+
+uint64_t FrameClock::ticks() const {
+    return tick_count;
+}
+
+uint64_t FrameClock::droppedTicks() const {
+    return dropped;
+}
+
+}
@@ -0,0 +1,385 @@
+#include "machine.h"
+
+#include <cstring>
+
+#include "dynarec.h"
+
+namespace chip8{
+
+// The body of every instruction. Both dispatch engines call these, so they
+// behave the same whichever one is built
+struct Ops {
+    static void nop(Machine &, const Decoded &) { // 0NNN -> Calls machine code routine at address NNN (ignored by modern machines)
+    }
+    static void invalid(Machine &m, const Decoded &d) { // Not a CHIP-8 instruction, skipped unless the machine is strict
+        if (!m.is_strict) return;
+        m.is_halted = true;
+        m.halt_instruction = d.aux;
+    }
+    static void cls(Machine &m, const Decoded &) { // 00E0 -> Clears the screen
+        for (int line = 0; line < SCREEN_HEIGHT; line++) {
+            if (m.display[line] != 0) m.dirty_rows |= 1u << line;
+            m.display[line] = 0;
+        }
+    }
+    static void ret(Machine &m, const Decoded &) { // 00EE -> Returns from a subroutine
+        if (m.sp == 0) {
+            m.is_halted = true; // returning from the top level ends the program
+            return;
+        }
+        m.pc = m.stack[--m.sp];
+    }
+    static void jp(Machine &m, const Decoded &d) { // 1NNN -> Jumps to address NNN
+        uint16_t self = (m.pc - 2) & 0x0FFF;
+        m.pc = d.nnn;
+        if (d.nnn == self) {
+            m.skipIdle(self, 1); // jumps to itself forever
+            return;
+        }
+        if (d.nnn == ((self - 2) & 0x0FFF)) {
+            // EX9E 1NNN or EXA1 1NNN polling a key, nothing changes until the key does
+            const Decoded &poll = m.icache[d.nnn];
+            if (poll.handler == nullptr) return;
+            if ((poll.op == Op::skp && !m.getKeyState(m.V[poll.x])) || (poll.op == Op::sknp && m.getKeyState(m.V[poll.x])))
+                m.skipIdle(d.nnn, 2);
+        }
+    }
+    static void call(Machine &m, const Decoded &d) { // 2NNN -> Calls subroutine at NNN
+        if (m.sp == 16) {
+            // ROMs that jump out of their subroutines never return, drop the oldest return address so they keep running
+            std::memmove(m.stack, m.stack + 1, sizeof(m.stack) - sizeof(m.stack[0]));
+            m.sp--;
+        }
+        m.stack[m.sp++] = m.pc;
+        m.pc = d.nnn;
+    }
+    static void se_vx_nn(Machine &m, const Decoded &d) { // 3XNN -> Skips the next instruction if VX equals NN
+        if (m.V[d.x] == d.nn) m.pc += 2;
+    }
+    static void sne_vx_nn(Machine &m, const Decoded &d) { // 4XNN -> Skips the next instruction if VX does not equal NN
+        if (m.V[d.x] != d.nn) m.pc += 2;
+    }
+    static void se_vx_vy(Machine &m, const Decoded &d) { // 5XY0 -> Skips the next instruction if VX equals VY
+        if (m.V[d.x] == m.V[d.y]) m.pc += 2;
+    }
+    static void ld_vx_nn(Machine &m, const Decoded &d) { // 6XNN -> Sets VX to NN
+        m.V[d.x] = d.nn;
+    }
+    static void add_vx_nn(Machine &m, const Decoded &d) { // 7XNN -> Adds NN to VX (carry flag is not changed)
+        m.V[d.x] += d.nn;
+    }
+    static void ld_vx_vy(Machine &m, const Decoded &d) { // 8XY0 -> Sets VX to the value of VY
+        m.V[d.x] = m.V[d.y];
+    }
+    static void or_vx_vy(Machine &m, const Decoded &d) { // 8XY1 -> Sets VX to VX or VY. (bitwise OR operation)
+        m.V[d.x] |= m.V[d.y];
+    }
+    static void and_vx_vy(Machine &m, const Decoded &d) { // 8XY2 -> Sets VX to VX and VY. (bitwise AND operation)
+        m.V[d.x] &= m.V[d.y];
+    }
+    static void xor_vx_vy(Machine &m, const Decoded &d) { // 8XY3 -> Sets VX to VX xor VY
+        m.V[d.x] ^= m.V[d.y];
+    }
+    static void add_vx_vy(Machine &m, const Decoded &d) { // 8XY4 -> Adds VY to VX. VF is set to 1 when there's an overflow, and to 0 when there is not
+        m.V[0xF] = (  (0xFF - m.V[d.x]) < m.V[d.y] ? 1 : 0  );
+        m.V[d.x] += m.V[d.y];
+    }
+    static void sub_vx_vy(Machine &m, const Decoded &d) { // 8XY5 -> VY is subtracted from VX. VF is set to 0 when there's an underflow, and 1 when there is not. (i.e. VF set to 1 if VX >= VY and 0 if not).
+        m.V[0xF] = (  (m.V[d.y] > m.V[d.x]) ? 0 : 1  );
+        m.V[d.x] -= m.V[d.y];
+    }
+    static void shr_vx(Machine &m, const Decoded &d) { // 8XY6 -> Shifts VX to the right by 1, then stores the least significant bit of VX prior to the shift into VF
+        m.V[0xF] = m.V[d.x] & 0x1;
+        m.V[d.x] >>= 1;
+    }
+    static void subn_vx_vy(Machine &m, const Decoded &d) { // 8XY7 -> Sets VX to VY minus VX. VF is set to 0 when there's an underflow, and 1 when there is not. (i.e. VF set to 1 if VY >= VX)
+        m.V[0xF] = (  (m.V[d.x] > m.V[d.y]) ? 0 : 1  );
+        m.V[d.x] = m.V[d.y] - m.V[d.x];
+    }
+    static void shl_vx(Machine &m, const Decoded &d) { // 8XYE -> Shifts VX to the left by 1, then sets VF to 1 if the most significant bit of VX prior to that shift was set, or to 0 if it was unset.
+        m.V[0xF] = ( (m.V[d.x] >> 7) == 1 ? 1 : 0 );
+        m.V[d.x] <<= 1;
+    }
+    static void sne_vx_vy(Machine &m, const Decoded &d) { // 9XY0 -> Skips the next instruction if VX does not equal VY
+        if (m.V[d.x] != m.V[d.y]) m.pc += 2;
+    }
+    static void ld_i_nnn(Machine &m, const Decoded &d) { // ANNN -> Sets I to the address NNN
+        m.I = d.nnn;
+    }
+    static void jp_v0(Machine &m, const Decoded &d) { // BNNN -> Jumps to the address NNN plus V0
+        m.pc = d.nnn + m.V[0];
+    }
+    static void rnd(Machine &m, const Decoded &d) { // CXNN -> Sets VX to the result of a bitwise and operation on a random number (Typically: 0 to 255) and NN
+        m.V[d.x] = (m.random() & d.nn);
+    }
+    static void drw(Machine &m, const Decoded &d) { // DXYN -> Draw a sprite at Vx Vy of 8*N, start at I
+        m.OC_DXYN(d.x, d.y, d.n);
+    }
+    static void skp(Machine &m, const Decoded &d) { // EX9E -> Skips the next instruction if the key stored in VX is pressed
+        if (m.getKeyState(m.V[d.x]) == 1) m.pc += 2;
+    }
+    static void sknp(Machine &m, const Decoded &d) { // EXA1 -> Skips the next instruction if the key stored in VX is not pressed
+        if (m.getKeyState(m.V[d.x]) == 0) m.pc += 2;
+    }
+    static void ld_vx_dt(Machine &m, const Decoded &d) { // FX07 -> Sets VX to the value of the delay timer
+        m.V[d.x] = m.delay_timer.get();
+    }
+    static void ld_vx_k(Machine &m, const Decoded &d) { // FX0A -> A key press is awaited, and then stored in VX (blocking operation, all instruction halted until next key event, see Machine::setKey)
+        m.key_wait = true;
+        m.key_wait_reg = d.x;
+    }
+    static void ld_dt_vx(Machine &m, const Decoded &d) { // FX15 -> Sets the delay timer to VX
+        m.delay_timer.set(m.V[d.x]);
+    }
+    static void ld_st_vx(Machine &m, const Decoded &d) { // FX18 -> Sets the sound timer to VX
+        m.audio_timer.set(m.V[d.x]);
+    }
+    static void add_i_vx(Machine &m, const Decoded &d) { // FX1E -> Adds VX to I. VF is not affected
+        m.I += m.V[d.x];
+    }
+    static void ld_f_vx(Machine &m, const Decoded &d) { // FX29 -> Sets I to the location of the sprite for the character in VX
+        m.I = Machine::sprite_offset + 5 * (m.V[d.x] & 0xF);
+    }
+    static void ld_b_vx(Machine &m, const Decoded &d) { // FX33 -> Stores the binary-coded decimal representation of VX in I
+        m.memory[(m.I + 0) & 0x0FFF] = m.V[d.x] / 100;           // hundreds at I
+        m.memory[(m.I + 1) & 0x0FFF] = (m.V[d.x] % 100) / 10;    // tens at I + 1
+        m.memory[(m.I + 2) & 0x0FFF] = m.V[d.x] % 10;            // digits at I + 2
+        m.invalidate(m.I, 3);
+    }
+    static void ld_mem_vx(Machine &m, const Decoded &d) { // FX55 -> Stores from V0 to VX (including VX) in memory, starting at address I. The offset from I is increased by 1 for each value written, but I itself is left unmodified
+        for (int k = 0; k <= d.x; k++) {
+            m.memory[(m.I + k) & 0x0FFF] = m.V[k];
+        }
+        m.invalidate(m.I, d.x + 1);
+    }
+    static void ld_vx_mem(Machine &m, const Decoded &d) { // FX65 -> Fills from V0 to VX (including VX) with values from memory, starting at address I. The offset from I is increased by 1 for each value read, but I itself is left unmodified
+        for (int k = 0; k <= d.x; k++) {
+            m.V[k] = m.memory[(m.I + k) & 0x0FFF];
+        }
+    }
+
+    // Superinstructions, each one does exactly what the sequence it replaces does
+    static void ld_ld_drw(Machine &m, const Decoded &d) { // 6XNN 6YNN DXYN -> Loads the sprite position and draws it
+        m.V[d.x] = d.nn;
+        m.V[(d.aux & 0x0F00) >> 8] = d.aux & 0x00FF;
+        m.OC_DXYN((d.nnn & 0x0F00) >> 8, (d.nnn & 0x00F0) >> 4, d.nnn & 0x000F);
+        m.pc += 4;
+        m.budget -= 2;
+    }
+    static void se_jp(Machine &m, const Decoded &d) { // 3XNN 1NNN -> Jumps to NNN unless VX equals NN
+        if (m.V[d.x] == d.nn) {
+            m.pc += 2;
+            return;
+        }
+        m.budget -= 1;
+        bool loops_to_itself = d.aux == ((m.pc - 2) & 0x0FFF);
+        m.pc = d.aux;
+        if (loops_to_itself) m.skipIdle(d.aux, 2); // VX never changes in this loop
+    }
+    static void dt_se_jp(Machine &m, const Decoded &d) { // FX07 3XNN 1NNN -> Waits for the delay timer to reach NN
+        m.V[d.x] = m.delay_timer.get();
+        m.budget -= 1;
+        if (m.V[d.x] == d.nn) {
+            m.pc += 4;
+            return;
+        }
+        m.budget -= 1;
+        bool loops_to_itself = d.aux == ((m.pc - 2) & 0x0FFF);
+        m.pc = d.aux;
+        if (loops_to_itself) m.skipIdle(d.aux, 3); // the delay timer only changes on the next tick
+    }
+};
+
+static constexpr Decoded::Handler handlers[] = {
+#define CHIP8_HANDLER(name) &Ops::name,
+    CHIP8_OPS(CHIP8_HANDLER)
+#undef CHIP8_HANDLER
+};
+
+Decoded Machine::decode(uint16_t instruction) {
+    Decoded op;
+    op.op = Op::invalid;
+    op.length = 1;
+    op.aux = 0;
+    op.nnn = instruction & 0x0FFF;
+    op.x = (instruction & 0x0F00) >> 8;
+    op.y = (instruction & 0x00F0) >> 4;
+    op.n = instruction & 0x000F;
+    op.nn = instruction & 0x00FF;
+
+    switch (instruction & 0xF000)
+    {
+    case 0x0000:
+        if (instruction == 0x00EE) op.op = Op::ret;
+        else if (instruction == 0x00E0) op.op = Op::cls;
+        else op.op = Op::nop;
+        break;
+    case 0x1000: op.op = Op::jp; break;
+    case 0x2000: op.op = Op::call; break;
+    case 0x3000: op.op = Op::se_vx_nn; break;
+    case 0x4000: op.op = Op::sne_vx_nn; break;
+    case 0x5000: op.op = Op::se_vx_vy; break;
+    case 0x6000: op.op = Op::ld_vx_nn; break;
+    case 0x7000: op.op = Op::add_vx_nn; break;
+    case 0x8000:
+        switch(instruction & 0x000F){
+        case 0x0000: op.op = Op::ld_vx_vy; break;
+        case 0x0001: op.op = Op::or_vx_vy; break;
+        case 0x0002: op.op = Op::and_vx_vy; break;
+        case 0x0003: op.op = Op::xor_vx_vy; break;
+        case 0x0004: op.op = Op::add_vx_vy; break;
+        case 0x0005: op.op = Op::sub_vx_vy; break;
+        case 0x0006: op.op = Op::shr_vx; break;
+        case 0x0007: op.op = Op::subn_vx_vy; break;
+        case 0x000E: op.op = Op::shl_vx; break;
+        }
+        break;
+    case 0x9000: op.op = Op::sne_vx_vy; break;
+    case 0xA000: op.op = Op::ld_i_nnn; break;
+    case 0xB000: op.op = Op::jp_v0; break;
+    case 0xC000: op.op = Op::rnd; break;
+    case 0xD000: op.op = Op::drw; break;
+    case 0xE000:
+        switch(instruction & 0x00FF){
+        case 0x009E: op.op = Op::skp; break;
+        case 0x00A1: op.op = Op::sknp; break;
+        }
+        break;
+    case 0xF000:
+        switch(instruction & 0x00FF){
+        case 0x0007: op.op = Op::ld_vx_dt; break;
+        case 0x000A: op.op = Op::ld_vx_k; break;
+        case 0x0015: op.op = Op::ld_dt_vx; break;
+        case 0x0018: op.op = Op::ld_st_vx; break;
+        case 0x001E: op.op = Op::add_i_vx; break;
+        case 0x0029: op.op = Op::ld_f_vx; break;
+        case 0x0033: op.op = Op::ld_b_vx; break;
+        case 0x0055: op.op = Op::ld_mem_vx; break;
+        case 0x0065: op.op = Op::ld_vx_mem; break;
+        }
+        break;
+    }
+    if (op.op == Op::invalid) op.aux = instruction;
+
+    op.handler = handlers[(int)op.op];
+    return op;
+}
+
+uint16_t Machine::instructionAt(uint16_t address) const {
+    return (memory[address & 0x0FFF] << 8) | memory[(address + 1) & 0x0FFF];
+}
+
+// Decodes the instruction at `address`, fusing it with the ones after it when they form a known sequence
+Decoded Machine::decodeAt(uint16_t address) const {
+    uint16_t first = instructionAt(address);
+    uint16_t second = instructionAt(address + 2);
+    uint16_t third = instructionAt(address + 4);
+    Decoded op = decode(first);
+
+    if ((first & 0xF000) == 0x6000 && (second & 0xF000) == 0x6000 && (third & 0xF000) == 0xD000) {
+        op.op = Op::ld_ld_drw;
+        op.aux = second;
+        op.nnn = third & 0x0FFF;
+        op.length = 3;
+    }
+    else if ((first & 0xF000) == 0x3000 && (second & 0xF000) == 0x1000) {
+        op.op = Op::se_jp;
+        op.aux = second & 0x0FFF;
+        op.length = 2;
+    }
+    else if ((first & 0xF0FF) == 0xF007 && (second & 0xFF00) == (0x3000 | (first & 0x0F00)) && (third & 0xF000) == 0x1000) {
+        op.op = Op::dt_se_jp;
+        op.nn = second & 0x00FF;
+        op.aux = third & 0x0FFF;
+        op.length = 3;
+    }
+
+    op.handler = handlers[(int)op.op];
+    return op;
+}
+
+// A superinstruction that does not fit in what is left of the budget is run as its first instruction alone
+const Decoded &Machine::fetch() {
+    Decoded &entry = icache[pc & 0x0FFF];
+    if (entry.handler == nullptr)
+        entry = decodeAt(pc);
+    if (entry.length > budget) {
+        unfused = decode(instructionAt(pc));
+        pc += 2;
+        budget--;
+        return unfused;
+    }
+    pc += 2;
+    budget--;
+    return entry;
+}
+
+void Machine::step() {
+    if (is_halted || key_wait) return;
+    is_idle = false;
+    budget = 1;
+    const Decoded &op = fetch();
+    op.handler(*this, op);
+}
+
+// Runs translated blocks where there are some and interprets the instructions that end them
+uint64_t Machine::runDynarec(uint64_t cycles) {
+    budget = cycles;
+    while (budget > 0 && !is_halted && !key_wait) {
+        budget -= dynarec->execute(*this, budget);
+        if (budget == 0) break;
+
+        const Decoded &op = fetch();
+        op.handler(*this, op);
+    }
+    return cycles - budget;
+}
+
+#if defined(CHIP8_THREADED_DISPATCH) && defined(__GNUC__)
+
+// Threaded dispatch with GCC's computed goto. Every instruction ends in its own
+// indirect jump to the next one, which the branch predictor can tell apart, and
+// the handler bodies are inlined because the calls below are direct
+uint64_t Machine::run(uint64_t cycles) {
+    is_idle = false;
+    if (dynarec) return runDynarec(cycles);
+
+    static void *const labels[] = {
+#define CHIP8_LABEL(name) &&op_##name,
+        CHIP8_OPS(CHIP8_LABEL)
+#undef CHIP8_LABEL
+    };
+
+    const Decoded *op;
+    budget = cycles;
+
+#define CHIP8_DISPATCH() \
+    if (budget == 0 || is_halted || key_wait) return cycles - budget; \
+    op = &fetch(); \
+    goto *labels[(int)op->op]
+
+    CHIP8_DISPATCH();
+
+#define CHIP8_BODY(name) op_##name: Ops::name(*this, *op); CHIP8_DISPATCH();
+    CHIP8_OPS(CHIP8_BODY)
+#undef CHIP8_BODY
+#undef CHIP8_DISPATCH
+}
+
+#else
+
+uint64_t Machine::run(uint64_t cycles) {
+    is_idle = false;
+    if (dynarec) return runDynarec(cycles);
+
+    budget = cycles;
+    while (budget > 0 && !is_halted && !key_wait) {
+        const Decoded &op = fetch();
+        op.handler(*this, op);
+    }
+    return cycles - budget;
+}
+
+#endif
+
+}
@@ -0,0 +1,422 @@
+#include "lockstep.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "machine_helpers.h"
+
+// Every lane when Uniform, otherwise only `lane`. The bounds are constants in the uniform case so the loops vectorize.
+// When Masked the lanes that are not active are skipped, which only costs something in the batches that need it
+#define CHIP8_FOR_LANES(l) \
+    for (int l = (Uniform ? 0 : lane); l < (Uniform ? Lanes : lane + 1); l++) \
+        if (Masked && !active[l]) {} else
+
+// With CHIP8_AVX2 the uniform lane loops get a second copy compiled for AVX2, picked at run time
+// when the CPU has it. Only that function is built for AVX2 (everything it calls is inlined into
+// it), so no inline function shared with other files can end up holding AVX2 code
+#if defined(CHIP8_AVX2) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CHIP8_LOCKSTEP_AVX2 1
+#else
+#define CHIP8_LOCKSTEP_AVX2 0
+#endif
+
+namespace chip8{
+
+// Instructions a lane runs alone before the lanes are checked for a common pc again
+static const uint64_t scalar_stretch = 16;
+
+template <int Lanes>
+Lockstep<Lanes>::Lockstep(const Machine &machine) : all_active(true), shared_memory(true), lockstep_steps(0), scalar_steps(0) {
+#if CHIP8_LOCKSTEP_AVX2
+    __builtin_cpu_init();
+    use_avx2 = __builtin_cpu_supports("avx2");
+#else
+    use_avx2 = false;
+#endif
+    for (int l = 0; l < Lanes; l++) {
+        for (int k = 0; k < 16; k++) {
+            V[k][l] = machine.V[k];
+            stack[k][l] = machine.stack[k];
+        }
+        I[l] = machine.I;
+        pc[l] = machine.pc;
+        sp[l] = machine.sp;
+        delay_timer[l] = machine.delay_timer.get();
+        audio_timer[l] = machine.audio_timer.get();
+        rng_state[l] = machine.rng_state;
+        keys[l] = machine.keys;
+        for (int line = 0; line < SCREEN_HEIGHT; line++)
+            display[line][l] = machine.display[line];
+        dirty_rows[l] = machine.dirty_rows;
+        std::memcpy(memory[l], machine.memory, sizeof(memory[l]));
+
+        key_wait[l] = machine.key_wait;
+        key_wait_reg[l] = machine.key_wait_reg;
+        is_halted[l] = machine.is_halted;
+        active[l] = true;
+    }
+}
+
+template <int Lanes>
+void Lockstep<Lanes>::seed(int lane, uint32_t value) {
+    rng_state[lane] = helpers::seedValue(value);
+}
+
+template <int Lanes>
+void Lockstep<Lanes>::setKeys(int lane, uint16_t mask) {
+    // Same as Machine::setKeys
+    uint16_t went_down = mask & ~keys[lane];
+    keys[lane] = mask;
+
+    if (went_down != 0 && key_wait[lane]) {
+        unsigned char key = 0;
+        while (((went_down >> key) & 1) == 0) key++;
+        V[key_wait_reg[lane]][lane] = key;
+        key_wait[lane] = false;
+    }
+}
+
+template <int Lanes>
+void Lockstep<Lanes>::store(int lane, Machine &machine) const {
+    for (int k = 0; k < 16; k++) {
+        machine.V[k] = V[k][lane];
+        machine.stack[k] = stack[k][lane];
+    }
+    machine.I = I[lane];
+    machine.pc = pc[lane];
+    machine.sp = sp[lane];
+    machine.delay_timer.set(delay_timer[lane]);
+    machine.audio_timer.set(audio_timer[lane]);
+    machine.rng_state = rng_state[lane];
+    machine.keys = keys[lane];
+    for (int line = 0; line < SCREEN_HEIGHT; line++)
+        machine.display[line] = display[line][lane];
+    machine.dirty_rows = dirty_rows[lane];
+    std::memcpy(machine.memory, memory[lane], sizeof(machine.memory));
+
+    machine.key_wait = key_wait[lane];
+    machine.key_wait_reg = key_wait_reg[lane];
+    machine.is_halted = is_halted[lane];
+    machine.flushCache();
+}
+
+template <int Lanes>
+bool Lockstep<Lanes>::halted(int lane) const {
+    return is_halted[lane];
+}
+
+template <int Lanes>
+bool Lockstep<Lanes>::waitingForKey(int lane) const {
+    return key_wait[lane];
+}
+
+template <int Lanes>
+uint64_t Lockstep<Lanes>::lockstepSteps() const {
+    return lockstep_steps;
+}
+
+template <int Lanes>
+uint64_t Lockstep<Lanes>::scalarSteps() const {
+    return scalar_steps;
+}
+
+template <int Lanes>
+void Lockstep<Lanes>::tickTimers() {
+    for (int l = 0; l < Lanes; l++) {
+        delay_timer[l] -= (delay_timer[l] > 0);
+        audio_timer[l] -= (audio_timer[l] > 0);
+    }
+}
+
+template <int Lanes>
+uint16_t Lockstep<Lanes>::instructionAt(int lane) const {
+    return (memory[lane][pc[lane] & 0x0FFF] << 8) | memory[lane][(pc[lane] + 1) & 0x0FFF];
+}
+
+// Marks the lanes that can run (not halted, not waiting for a key) as active. Returns true
+// when there is at least one and every active lane is about to run the same instruction,
+// `lead` is then the first of them. Lanes that stopped do not keep the others apart
+template <int Lanes>
+bool Lockstep<Lanes>::converged(int &lead) {
+    bool all = true;
+    for (int l = 0; l < Lanes; l++) {
+        active[l] = !key_wait[l] & !is_halted[l];
+        all &= active[l];
+    }
+    all_active = all;
+
+    bool same = true;
+    if (all) {
+        // The usual case, kept free of branches
+        lead = 0;
+        for (int l = 0; l < Lanes; l++) same &= (pc[l] == pc[0]);
+    }
+    else {
+        lead = -1;
+        for (int l = 0; l < Lanes; l++) {
+            if (!active[l]) continue;
+            if (lead < 0) lead = l;
+            same &= (pc[l] == pc[lead]);
+        }
+    }
+    if (lead < 0 || !same) return false;
+    if (shared_memory) return true;
+
+    uint16_t instruction = instructionAt(lead);
+    for (int l = lead + 1; l < Lanes; l++) {
+        if (active[l] && instructionAt(l) != instruction) return false;
+    }
+    return true;
+}
+
+// Same as Machine::OC_DXYN for one lane
+template <int Lanes>
+void Lockstep<Lanes>::draw(int lane, uint8_t X, uint8_t Y, uint8_t N) {
+    unsigned int x = V[X][lane] % SCREEN_WIDTH;
+    unsigned int y = V[Y][lane] % SCREEN_HEIGHT;
+    uint64_t collision = 0;
+    for (int he = 0; he < N; he++) {
+        uint64_t row = helpers::spriteRow(memory[lane][(I[lane] + he) & 0x0FFF], x);
+        unsigned int line = (y + he) % SCREEN_HEIGHT;
+        collision |= display[line][lane] & row;
+        display[line][lane] ^= row;
+        if (row != 0) dirty_rows[lane] |= 1u << line;
+    }
+    V[0xF][lane] = (collision != 0);
+}
+
+template <int Lanes>
+template <bool Uniform, bool Masked>
+void Lockstep<Lanes>::execute(uint16_t instruction, int lane) {
+    uint8_t x = (instruction & 0x0F00) >> 8;
+    uint8_t y = (instruction & 0x00F0) >> 4;
+    uint8_t n = instruction & 0x000F;
+    uint8_t nn = instruction & 0x00FF;
+    uint16_t nnn = instruction & 0x0FFF;
+
+    switch (instruction & 0xF000)
+    {
+    case 0x0000:
+        if (instruction == 0x00E0) { // 00E0
+            CHIP8_FOR_LANES(l) {
+                for (int line = 0; line < SCREEN_HEIGHT; line++) {
+                    if (display[line][l] != 0) dirty_rows[l] |= 1u << line;
+                    display[line][l] = 0;
+                }
+            }
+        }
+        else if (instruction == 0x00EE) { // 00EE
+            CHIP8_FOR_LANES(l) {
+                if (sp[l] == 0) is_halted[l] = true;
+                else pc[l] = stack[--sp[l]][l];
+            }
+        }
+        break;
+    case 0x1000: // 1NNN
+        CHIP8_FOR_LANES(l) pc[l] = nnn;
+        break;
+    case 0x2000: // 2NNN
+        CHIP8_FOR_LANES(l) {
+            if (sp[l] == 16) {
+                for (int k = 0; k < 15; k++) stack[k][l] = stack[k + 1][l];
+                sp[l]--;
+            }
+            stack[sp[l]++][l] = pc[l];
+            pc[l] = nnn;
+        }
+        break;
+    case 0x3000: // 3XNN
+        CHIP8_FOR_LANES(l) pc[l] += (V[x][l] == nn ? 2 : 0);
+        break;
+    case 0x4000: // 4XNN
+        CHIP8_FOR_LANES(l) pc[l] += (V[x][l] != nn ? 2 : 0);
+        break;
+    case 0x5000: // 5XY0
+        CHIP8_FOR_LANES(l) pc[l] += (V[x][l] == V[y][l] ? 2 : 0);
+        break;
+    case 0x6000: // 6XNN
+        CHIP8_FOR_LANES(l) V[x][l] = nn;
+        break;
+    case 0x7000: // 7XNN
+        CHIP8_FOR_LANES(l) V[x][l] += nn;
+        break;
+    case 0x8000:
+        // VF is written before the result like in the interpreter, so X or Y being F behaves the same
+        switch (n)
+        {
+        case 0x0: CHIP8_FOR_LANES(l) V[x][l] = V[y][l]; break;
+        case 0x1: CHIP8_FOR_LANES(l) V[x][l] |= V[y][l]; break;
+        case 0x2: CHIP8_FOR_LANES(l) V[x][l] &= V[y][l]; break;
+        case 0x3: CHIP8_FOR_LANES(l) V[x][l] ^= V[y][l]; break;
+        case 0x4:
+            CHIP8_FOR_LANES(l) {
+                V[0xF][l] = ((0xFF - V[x][l]) < V[y][l] ? 1 : 0);
+                V[x][l] += V[y][l];
+            }
+            break;
+        case 0x5:
+            CHIP8_FOR_LANES(l) {
+                V[0xF][l] = (V[y][l] > V[x][l] ? 0 : 1);
+                V[x][l] -= V[y][l];
+            }
+            break;
+        case 0x6:
+            CHIP8_FOR_LANES(l) {
+                V[0xF][l] = V[x][l] & 0x1;
+                V[x][l] >>= 1;
+            }
+            break;
+        case 0x7:
+            CHIP8_FOR_LANES(l) {
+                V[0xF][l] = (V[x][l] > V[y][l] ? 0 : 1);
+                V[x][l] = V[y][l] - V[x][l];
+            }
+            break;
+        case 0xE:
+            CHIP8_FOR_LANES(l) {
+                V[0xF][l] = V[x][l] >> 7;
+                V[x][l] <<= 1;
+            }
+            break;
+        }
+        break;
+    case 0x9000: // 9XY0
+        CHIP8_FOR_LANES(l) pc[l] += (V[x][l] != V[y][l] ? 2 : 0);
+        break;
+    case 0xA000: // ANNN
+        CHIP8_FOR_LANES(l) I[l] = nnn;
+        break;
+    case 0xB000: // BNNN
+        CHIP8_FOR_LANES(l) pc[l] = nnn + V[0][l];
+        break;
+    case 0xC000: // CXNN
+        CHIP8_FOR_LANES(l) {
+            rng_state[l] = helpers::xorshift(rng_state[l]);
+            V[x][l] = rng_state[l] & nn;
+        }
+        break;
+    case 0xD000: // DXYN
+        CHIP8_FOR_LANES(l) draw(l, x, y, n);
+        break;
+    case 0xE000:
+        if (nn == 0x9E) { // EX9E
+            CHIP8_FOR_LANES(l) pc[l] += (V[x][l] <= 0xF && ((keys[l] >> V[x][l]) & 1) ? 2 : 0);
+        }
+        else if (nn == 0xA1) { // EXA1
+            CHIP8_FOR_LANES(l) pc[l] += (V[x][l] <= 0xF && ((keys[l] >> V[x][l]) & 1) ? 0 : 2);
+        }
+        break;
+    case 0xF000:
+        switch (nn)
+        {
+        case 0x07: CHIP8_FOR_LANES(l) V[x][l] = delay_timer[l]; break;
+        case 0x0A:
+            CHIP8_FOR_LANES(l) {
+                key_wait[l] = true;
+                key_wait_reg[l] = x;
+            }
+            break;
+        case 0x15: CHIP8_FOR_LANES(l) delay_timer[l] = V[x][l]; break;
+        case 0x18: CHIP8_FOR_LANES(l) audio_timer[l] = V[x][l]; break;
+        case 0x1E: CHIP8_FOR_LANES(l) I[l] += V[x][l]; break;
+        case 0x29: CHIP8_FOR_LANES(l) I[l] = Machine::sprite_offset + 5 * (V[x][l] & 0xF); break;
+        case 0x33:
+        case 0x55:
+            CHIP8_FOR_LANES(l) {
+                if (nn == 0x33) {
+                    memory[l][(I[l] + 0) & 0x0FFF] = V[x][l] / 100;
+                    memory[l][(I[l] + 1) & 0x0FFF] = (V[x][l] % 100) / 10;
+                    memory[l][(I[l] + 2) & 0x0FFF] = V[x][l] % 10;
+                }
+                else {
+                    for (int k = 0; k <= x; k++)
+                        memory[l][(I[l] + k) & 0x0FFF] = V[k][l];
+                }
+            }
+            // Lanes that were left out did not write, so their memory is different now
+            if (!Uniform || Masked) {
+                shared_memory = false;
+                break;
+            }
+            // The memories only stay the same if every lane wrote the same bytes to the same place
+            for (int l = 1; l < Lanes && shared_memory; l++) {
+                bool same = (I[l] == I[0]);
+                for (int k = (nn == 0x33 ? x : 0); k <= x; k++)
+                    same &= (V[k][l] == V[k][0]);
+                shared_memory = same;
+            }
+            break;
+        case 0x65:
+            CHIP8_FOR_LANES(l) {
+                for (int k = 0; k <= x; k++)
+                    V[k][l] = memory[l][(I[l] + k) & 0x0FFF];
+            }
+            break;
+        }
+        break;
+    }
+}
+
+template <int Lanes>
+template <bool Masked>
+void Lockstep<Lanes>::executeAll(uint16_t instruction) {
+#if CHIP8_LOCKSTEP_AVX2
+    if (use_avx2) {
+        executeAvx2<Masked>(instruction);
+        return;
+    }
+#endif
+    execute<true, Masked>(instruction, 0);
+}
+
+#if CHIP8_LOCKSTEP_AVX2
+template <int Lanes>
+template <bool Masked>
+__attribute__((target("avx2"), flatten)) void Lockstep<Lanes>::executeAvx2(uint16_t instruction) {
+    execute<true, Masked>(instruction, 0);
+}
+#endif
+
+template <int Lanes>
+void Lockstep<Lanes>::run(uint64_t cycles) {
+    uint64_t cycle = 0;
+    while (cycle < cycles) {
+        int lead;
+        if (converged(lead)) {
+            uint16_t instruction = instructionAt(lead);
+            if (all_active) {
+                for (int l = 0; l < Lanes; l++) pc[l] += 2;
+                executeAll<false>(instruction);
+            }
+            else {
+                for (int l = 0; l < Lanes; l++) pc[l] += (active[l] ? 2 : 0);
+                executeAll<true>(instruction);
+            }
+            lockstep_steps++;
+            cycle++;
+            continue;
+        }
+
+        // The lanes never touch each other, so each one can run a stretch on its own as long as
+        // they all end it at the same instruction count and look for a common pc again
+        uint64_t stretch = std::min<uint64_t>(cycles - cycle, scalar_stretch);
+        bool any = false;
+        for (int l = 0; l < Lanes; l++) {
+            for (uint64_t k = 0; k < stretch && !is_halted[l] && !key_wait[l]; k++) {
+                uint16_t instruction = instructionAt(l);
+                pc[l] += 2;
+                execute<false, false>(instruction, l);
+                scalar_steps++;
+                any = true;
+            }
+        }
+        if (!any) return;
+        cycle += stretch;
+    }
+}
+
+template class Lockstep<8>;
+template class Lockstep<16>;
+template class Lockstep<32>;
+
+}
@@ -0,0 +1,263 @@
+#include "machine.h"
+
+#include "dynarec.h"
+#include "machine_helpers.h"
+#include "snapshot.h"
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+namespace chip8{
+
+static const uint32_t all_rows = (SCREEN_HEIGHT == 32 ? 0xFFFFFFFFu : (1u << SCREEN_HEIGHT) - 1);
+
+static const unsigned char sprite[5 * 16] = {
+    0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+    0x20, 0x60, 0x20, 0x20, 0x70, // 1
+    0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+    0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+    0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+    0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+    0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+    0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+    0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+    0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+    0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+    0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+    0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+    0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+    0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+    0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+};
+
+Machine::Machine() : icache(sizeof(memory)) {
+    rng_state = helpers::default_seed;
+    budget = 0;
+    is_strict = false;
+    reset();
+}
+
+Machine::~Machine() = default;
+
+bool Machine::setDynarec(bool enabled) {
+    if (!enabled) {
+        dynarec.reset();
+        return true;
+    }
+    if (!Dynarec::supported()) return false;
+    if (!dynarec) dynarec.reset(new Dynarec());
+    return true;
+}
+
+bool Machine::dynarecEnabled() const {
+    return dynarec != nullptr;
+}
+
+void Machine::setStrict(bool enabled) {
+    is_strict = enabled;
+}
+
+bool Machine::strict() const {
+    return is_strict;
+}
+
+void Machine::reset() {
+    std::memset(V, 0, sizeof(V));
+    I = 0;
+    pc = mem_offset;
+    std::memset(stack, 0, sizeof(stack));
+    sp = 0;
+
+    std::memset(memory, 0, sizeof(memory));
+    std::memcpy(memory + sprite_offset, sprite, sizeof(sprite));
+    flushCache();
+
+    std::memset(display, 0, sizeof(display));
+    dirty_rows = all_rows;
+
+    keys = 0;
+    key_wait = false;
+    key_wait_reg = 0;
+
+    is_halted = false;
+    halt_instruction = 0;
+
+    is_idle = false;
+    idle_cycles = 0;
+
+    delay_timer.set(0);
+    audio_timer.set(0);
+}
+
+void Machine::seed(uint32_t value) {
+    rng_state = helpers::seedValue(value);
+}
+
+bool Machine::loadRom(const std::string &path) {
+    std::ifstream fin(path, std::ios::in | std::ios::binary);
+    if (!fin.is_open()) return false;
+
+    std::vector<unsigned char> data((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+    return loadRom(data.data(), data.size());
+}
+
+bool Machine::loadRom(const unsigned char *data, size_t size) {
+    if (size > sizeof(memory) - mem_offset) return false;
+
+    reset();
+    std::memcpy(memory + mem_offset, data, size);
+    flushCache();
+    return true;
+}
+
+void Machine::save(Snapshot &snapshot) const {
+    snapshot.magic = Snapshot::magic_value;
+    snapshot.version = Snapshot::current_version;
+    std::memcpy(snapshot.memory, memory, sizeof(memory));
+    std::memcpy(snapshot.display, display, sizeof(display));
+    std::memcpy(snapshot.stack, stack, sizeof(stack));
+    std::memcpy(snapshot.V, V, sizeof(V));
+    snapshot.I = I;
+    snapshot.pc = pc;
+    snapshot.sp = sp;
+    snapshot.delay_timer = delay_timer.get();
+    snapshot.audio_timer = audio_timer.get();
+    snapshot.key_wait = key_wait;
+    snapshot.key_wait_reg = key_wait_reg;
+    snapshot.halted = is_halted;
+    snapshot.keys = keys;
+    snapshot.halt_instruction = halt_instruction;
+    snapshot.reserved = 0;
+    snapshot.rng_state = rng_state;
+    snapshot.reserved_end = 0;
+}
+
+bool Machine::load(const Snapshot &snapshot) {
+    if (snapshot.magic != Snapshot::magic_value || snapshot.version != Snapshot::current_version) return false;
+    // Snapshots can come from files, values the machine could never have reached would let it write out of bounds
+    if (snapshot.sp > 16 || snapshot.key_wait_reg > 0xF || snapshot.key_wait > 1 || snapshot.halted > 1) return false;
+
+    // Only the parts of memory that differ are copied and dropped from the instruction
+    // cache, a snapshot of the same program usually only differs in a few data bytes
+    static const int block = 64;
+    for (int address = 0; address < (int)sizeof(memory); address += block) {
+        if (std::memcmp(memory + address, snapshot.memory + address, block) == 0) continue;
+        std::memcpy(memory + address, snapshot.memory + address, block);
+        invalidate(address, block);
+    }
+
+    std::memcpy(display, snapshot.display, sizeof(display));
+    dirty_rows = all_rows;
+    std::memcpy(stack, snapshot.stack, sizeof(stack));
+    std::memcpy(V, snapshot.V, sizeof(V));
+    I = snapshot.I;
+    pc = snapshot.pc;
+    sp = snapshot.sp;
+    delay_timer.set(snapshot.delay_timer);
+    audio_timer.set(snapshot.audio_timer);
+    key_wait = snapshot.key_wait;
+    key_wait_reg = snapshot.key_wait_reg;
+    is_halted = snapshot.halted;
+    keys = snapshot.keys;
+    halt_instruction = snapshot.halt_instruction;
+    rng_state = snapshot.rng_state;
+    is_idle = false;
+    return true;
+}
+
+unsigned char Machine::random() {
+    rng_state = helpers::xorshift(rng_state);
+    return rng_state & 0xFF;
+}
+
+void Machine::setKey(unsigned int key, bool pressed) {
+    if (key > 0xF) return;
+    setKeys(pressed ? (keys | 1u << key) : (keys & ~(1u << key)));
+}
+
+void Machine::setKeys(uint16_t mask, uint16_t pressed) {
+    // Only a new press ends FX0A, a key that was already held when it started does not
+    uint16_t went_down = (mask & ~keys) | pressed;
+    keys = mask;
+
+    if (went_down != 0 && key_wait) {
+        unsigned char key = 0;
+        while (((went_down >> key) & 1) == 0) key++;
+        V[key_wait_reg] = key;
+        key_wait = false;
+    }
+}
+
+uint16_t Machine::keyMask() const {
+    return keys;
+}
+
+bool Machine::waitingForKey() const {
+    return key_wait;
+}
+
+bool Machine::halted() const {
+    return is_halted;
+}
+
+bool Machine::idle() const {
+    return is_idle;
+}
+
+uint64_t Machine::idleCycles() const {
+    return idle_cycles;
+}
+
+uint16_t Machine::haltInstruction() const {
+    return halt_instruction;
+}
+
+bool Machine::soundActive() const {
+    return audio_timer.get() > 0;
+}
+
+void Machine::OC_DXYN(uint8_t X, uint8_t Y, uint8_t N) {
+    unsigned int x = V[X] % SCREEN_WIDTH;
+    unsigned int y = V[Y] % SCREEN_HEIGHT;
+    uint64_t collision = 0;
+    for (int he = 0; he < N; he++) {
+        uint64_t row = helpers::spriteRow(memory[(I + he) & 0x0FFF], x);
+        unsigned int line = (y + he) % SCREEN_HEIGHT;
+        collision |= display[line] & row;
+        display[line] ^= row;
+        if (row != 0) dirty_rows |= 1u << line;
+    }
+    V[0xF] = (collision != 0);
+}
+
+void Machine::invalidate(uint16_t address, uint16_t length) {
+    // Entries starting up to 5 bytes before `address` cover it, superinstructions are up to 3 instructions long
+    for (uint16_t i = 0; i < length + 5; i++)
+        icache[(address - 5 + i) & 0x0FFF].handler = nullptr;
+    if (dynarec) dynarec->invalidate(address, length);
+}
+
+// The program is in a loop of `length` instructions starting at `start` (where pc is now) that
+// changes nothing until the next timer tick or key press, so the rest of this run() would only
+// repeat it. End the run where spinning would have left pc and count what was left as executed
+void Machine::skipIdle(uint16_t start, uint8_t length) {
+    pc = start + 2 * (budget % length);
+    idle_cycles += budget;
+    budget = 0;
+    is_idle = true;
+}
+
+void Machine::flushCache() {
+    for (Decoded &entry : icache)
+        entry.handler = nullptr;
+    if (dynarec) dynarec->flush();
+}
+
+void Machine::tickTimers(uint32_t ticks) {
+    delay_timer.tick(ticks);
+    audio_timer.tick(ticks);
+}
+
+}
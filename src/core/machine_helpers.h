@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+
+#include "machine.h"
+
+// Pieces of the instruction set that Machine and Lockstep both need. Keeping
+// them in one place makes sure the two engines compute the same results
+namespace chip8{
+namespace helpers{
+
+// Seed used when none is given, xorshift gets stuck on 0 so 0 maps to it as well
+static constexpr uint32_t default_seed = 0x2545F491;
+
+inline uint32_t seedValue(uint32_t value) {
+    return value == 0 ? default_seed : value;
+}
+
+// The next state of the xorshift32 generator behind CXNN
+inline uint32_t xorshift(uint32_t state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+// A sprite byte as a display row with its leftmost pixel at column `x`, the pixels past the right edge wrap around
+inline uint64_t spriteRow(uint8_t byte, unsigned int x) {
+    uint64_t row = (uint64_t)byte << (SCREEN_WIDTH - 8);
+    return (row >> x) | (row << ((SCREEN_WIDTH - x) & (SCREEN_WIDTH - 1)));
+}
+
+}
+}
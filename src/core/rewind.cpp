@@ -0,0 +1,95 @@
+#include "rewind.h"
+
+#include <cstring>
+
+namespace chip8{
+
+Rewind::Rewind(uint32_t frames) {
+    uint32_t intervals = (frames + keyframe_interval - 1) / keyframe_interval;
+    slots.resize((size_t)(intervals == 0 ? 1 : intervals) * keyframe_interval);
+}
+
+std::vector<uint64_t> &Rewind::slot(uint64_t frame) {
+    return slots[frame % slots.size()];
+}
+
+uint64_t Rewind::oldest() const {
+    // A delta needs its keyframe, so the history starts at the oldest keyframe still stored
+    return (tail + keyframe_interval - 1) / keyframe_interval * keyframe_interval;
+}
+
+void Rewind::push(const Machine &machine) {
+    if (head - tail == slots.size()) tail++;
+
+    machine.save(current);
+    uint64_t state[words];
+    std::memcpy(state, &current, sizeof(current));
+
+    // The slots of keyframes and of deltas never trade places since the ring is a whole
+    // number of intervals long, so each keeps the capacity it needs after the first lap
+    std::vector<uint64_t> &out = slot(head);
+    out.clear();
+    if (head % keyframe_interval == 0) {
+        out.assign(state, state + words);
+        head++;
+        return;
+    }
+
+    const uint64_t *key = slot(head - head % keyframe_interval).data();
+    size_t i = 0;
+    while (i < words) {
+        size_t skip = i;
+        while (i < words && state[i] == key[i]) i++;
+        if (i == words) break;
+        size_t header = out.size();
+        out.push_back(0);
+        size_t first = i;
+        for (; i < words && state[i] != key[i]; i++) out.push_back(state[i] ^ key[i]);
+        out[header] = (uint64_t)(first - skip) | ((uint64_t)(i - first) << 32);
+    }
+    head++;
+}
+
+bool Rewind::pop(Machine &machine) {
+    if (head <= oldest()) return false;
+    head--;
+
+    const std::vector<uint64_t> &frame = slot(head);
+    uint64_t state[words];
+    if (head % keyframe_interval == 0) {
+        std::memcpy(state, frame.data(), sizeof(state));
+    }
+    else {
+        const uint64_t *key = slot(head - head % keyframe_interval).data();
+        std::memcpy(state, key, sizeof(state));
+        size_t i = 0;
+        for (size_t run = 0; run < frame.size();) {
+            uint64_t header = frame[run++];
+            i += (uint32_t)header;
+            for (uint32_t n = (uint32_t)(header >> 32); n > 0; n--, i++) state[i] ^= frame[run++];
+        }
+    }
+    std::memcpy(static_cast<void *>(&current), state, sizeof(current));
+    return machine.load(current);
+}
+
+void Rewind::clear() {
+    head = 0;
+    tail = 0;
+}
+
+uint32_t Rewind::size() const {
+    return (uint32_t)(head > oldest() ? head - oldest() : 0);
+}
+
+uint32_t Rewind::capacity() const {
+    return (uint32_t)slots.size();
+}
+
+size_t Rewind::bytes() const {
+    size_t total = 0;
+    for (const std::vector<uint64_t> &frame : slots) total += frame.capacity() * sizeof(uint64_t);
+    return total;
+}
+
+}
@@ -0,0 +1,49 @@
+#include "scheduler.h"
+
+#include <algorithm>
+
+namespace chip8{
+
+// How many instructions run between two clock reads in unlimited mode
+static const uint64_t unlimited_batch = 1000;
+
+Scheduler::Scheduler(Machine &machine, uint32_t instructions_per_second) : machine(machine) {
+    setInstructionsPerSecond(instructions_per_second);
+}
+
+void Scheduler::setInstructionsPerSecond(uint32_t instructions_per_second) {
+    rate = instructions_per_second;
+    remainder = 0;
+}
+
+uint32_t Scheduler::instructionsPerSecond() const {
+    return rate;
+}
+
+uint64_t Scheduler::tick(std::chrono::steady_clock::time_point deadline) {
+    uint64_t executed = 0;
+
+    if (rate == unlimited) {
+        // An idle program is waiting for the next tick, there is nothing more to run until then
+        while (!machine.halted() && !machine.waitingForKey() && std::chrono::steady_clock::now() < deadline) {
+            executed += machine.run(unlimited_batch);
+            if (machine.idle()) break;
+        }
+    }
+    else {
+        uint32_t cycles = (rate + remainder) / TIMER_HZ;
+        remainder = (rate + remainder) % TIMER_HZ;
+        executed = machine.run(cycles);
+    }
+
+    machine.tickTimers();
+    return executed;
+}
+
+void Scheduler::skip(uint64_t ticks) {
+    if (ticks == 0) return;
+    // The timers are 8 bits, anything past 255 ticks just empties them
+    machine.tickTimers((uint32_t)std::min<uint64_t>(ticks, 0xFF));
+}
+
+}
@@ -0,0 +1,25 @@
+#include "snapshot.h"
+
+#include <fstream>
+
+namespace chip8{
+
+bool saveSnapshot(const Snapshot &snapshot, const std::string &path) {
+    std::ofstream fout(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!fout.is_open()) return false;
+    fout.write(reinterpret_cast<const char *>(&snapshot), sizeof(snapshot));
+    return fout.good();
+}
+
+bool loadSnapshot(const std::string &path, Snapshot &snapshot) {
+    std::ifstream fin(path, std::ios::in | std::ios::binary);
+    if (!fin.is_open()) return false;
+
+    Snapshot read;
+    if (!fin.read(reinterpret_cast<char *>(&read), sizeof(read))) return false;
+    if (read.magic != Snapshot::magic_value || read.version != Snapshot::current_version) return false;
+    snapshot = read;
+    return true;
+}
+
+}
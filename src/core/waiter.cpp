@@ -0,0 +1,126 @@
+#include "waiter.h"
+
+#include <cmath>
+#include <thread>
+
+#if defined(__unix__)
+#include <cerrno>
+#include <time.h>
+#endif
+
+namespace chip8{
+
+Waiter::Waiter(Mode mode) : current(mode) {
+    estimate = 1e-3;
+    mean = 1e-3;
+    m2 = 0;
+    count = 1;
+}
+
+void Waiter::setMode(Mode mode) {
+    current = mode;
+}
+
+Waiter::Mode Waiter::mode() const {
+    return current;
+}
+
+bool Waiter::modeFromName(const std::string &name, Mode &mode) {
+    if (name == "sleep") mode = Mode::sleep;
+    else if (name == "hybrid") mode = Mode::hybrid;
+    else if (name == "nanosleep") mode = Mode::nanosleep;
+    else if (name == "busy") mode = Mode::busy;
+    else return false;
+    return true;
+}
+
+const WaiterStats &Waiter::stats() const {
+    return counters;
+}
+
+void Waiter::resetStats() {
+    counters = WaiterStats();
+}
+
+void Waiter::waitUntil(clock::time_point deadline) {
+    switch (current)
+    {
+    case Mode::sleep:
+        sleepUntil(deadline);
+        break;
+    case Mode::hybrid:
+        hybridWait(deadline);
+        break;
+    case Mode::nanosleep:
+        nanosleepUntil(deadline);
+        break;
+    case Mode::busy:
+        spinUntil(deadline);
+        break;
+    }
+
+    clock::time_point now = clock::now();
+    if (now > deadline) counters.overshoot += now - deadline;
+    counters.waits++;
+}
+
+void Waiter::sleepUntil(clock::time_point deadline) {
+    clock::time_point start = clock::now();
+    if (start >= deadline) return;
+    std::this_thread::sleep_until(deadline);
+    counters.slept += clock::now() - start;
+}
+
+void Waiter::spinUntil(clock::time_point deadline) {
+    clock::time_point start = clock::now();
+    if (start >= deadline) return;
+    while (clock::now() < deadline);
+    counters.spun += clock::now() - start;
+}
+
+void Waiter::hybridWait(clock::time_point deadline) {
+    using namespace std::chrono;
+
+    // One sleep that should wake us up `estimate` seconds early, the rest is spent yielding
+    clock::time_point wake = deadline - duration_cast<clock::duration>(duration<double>(estimate));
+    clock::time_point start = clock::now();
+    if (start < wake) {
+        std::this_thread::sleep_until(wake);
+        clock::time_point end = clock::now();
+        counters.slept += end - start;
+
+        double observed = duration<double>(end - wake).count(); // how late the OS woke us up
+        ++count;
+        double delta = observed - mean;
+        mean += delta / count;
+        m2 += delta * (observed - mean);
+        double stddev = std::sqrt(m2 / (count - 1));
+        estimate = mean + stddev;
+    }
+
+    start = clock::now();
+    if (start >= deadline) return;
+    while (clock::now() < deadline)
+        std::this_thread::yield();
+    counters.spun += clock::now() - start;
+}
+
+void Waiter::nanosleepUntil(clock::time_point deadline) {
+#if defined(__unix__)
+    // steady_clock is CLOCK_MONOTONIC with libstdc++ and libc++
+    clock::time_point start = clock::now();
+    if (start >= deadline) return;
+
+    int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count();
+    timespec ts;
+    ts.tv_sec = ns / 1000000000;
+    ts.tv_nsec = ns % 1000000000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR);
+
+    counters.slept += clock::now() - start;
+#else
+    hybridWait(deadline);
+#endif
+}
+
+}
@@ -0,0 +1,132 @@
+#include "batch.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+namespace chip8{
+
+struct BatchResult {
+    bool loaded = false;
+    bool halted = false;
+    uint16_t halt_instruction = 0;
+    RunResult run;
+};
+
+static bool parseField(const std::string &field, uint64_t &value) {
+    char *end = nullptr;
+    value = std::strtoull(field.c_str(), &end, 10);
+    return end != field.c_str() && *end == '\0';
+}
+
+static bool parseManifestLine(const std::string &line, const RunOptions &defaults, BatchJob &job) {
+    std::vector<std::string> fields;
+    std::stringstream ss(line);
+    std::string field;
+    while (std::getline(ss, field, '\t'))
+        fields.push_back(field);
+    if (fields.empty() || fields.size() > 4 || fields[0].empty()) return false;
+
+    job.rom = fields[0];
+    job.options = defaults;
+    uint64_t value = 0;
+    if (fields.size() > 1) {
+        if (!parseField(fields[1], value)) return false;
+        job.options.frames = value;
+    }
+    if (fields.size() > 2) {
+        if (!parseField(fields[2], value) || value == 0 || value > UINT32_MAX) return false;
+        job.options.instructions_per_second = (uint32_t)value;
+    }
+    if (fields.size() > 3) {
+        if (!parseField(fields[3], value)) return false;
+        job.options.seed = (uint32_t)value;
+    }
+    return true;
+}
+
+bool loadBatch(const std::string &source, const RunOptions &defaults, std::vector<BatchJob> &jobs) {
+    std::error_code error;
+    if (std::filesystem::is_directory(source, error)) {
+        std::vector<std::string> roms;
+        // The error_code overloads throughout, an unreadable directory is reported instead of thrown
+        std::filesystem::directory_iterator it(source, error), end;
+        for (; !error && it != end; it.increment(error)) {
+            const std::filesystem::directory_entry &entry = *it;
+            std::string extension = entry.path().extension().string();
+            std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+            // An entry that cannot be looked at (e.g. a broken symlink) is not a ROM, the others still run
+            std::error_code entry_error;
+            if (entry.is_regular_file(entry_error) && (extension == ".ch8" || extension == ".c8")) roms.push_back(entry.path().string());
+        }
+        if (error) return false;
+        std::sort(roms.begin(), roms.end());
+        for (const std::string &rom : roms)
+            jobs.push_back({ rom, defaults });
+        return true;
+    }
+
+    std::ifstream fin(source);
+    if (!fin.is_open()) return false;
+    std::string line;
+    int number = 0;
+    while (std::getline(fin, line)) {
+        number++;
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty() || line[0] == '#') continue;
+
+        BatchJob job;
+        if (!parseManifestLine(line, defaults, job)) {
+            std::fprintf(stderr, "%s:%d: bad manifest line\n", source.c_str(), number);
+            return false;
+        }
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+static void runJob(const BatchJob &job, BatchResult &result) {
+    Machine machine;
+    machine.seed(job.options.seed);
+    machine.setStrict(true);
+    if (job.options.dynarec) machine.setDynarec(true);
+    if (!machine.loadRom(job.rom)) return;
+
+    result.loaded = true;
+    result.run = runFrames(machine, job.options);
+    result.halted = machine.halted();
+    result.halt_instruction = machine.haltInstruction();
+}
+
+void runBatch(const std::vector<BatchJob> &jobs, ThreadPool &pool, std::ostream &out) {
+    // Every job writes only its own slot, so the results need no lock
+    std::vector<BatchResult> results(jobs.size());
+    for (size_t i = 0; i < jobs.size(); i++)
+        pool.submit([&jobs, &results, i] { runJob(jobs[i], results[i]); });
+    pool.wait();
+
+    out << "rom\tframes\tcpu_hz\tseed\tstatus\tframebuffer\tinstructions\twall_ms\n";
+    for (size_t i = 0; i < jobs.size(); i++) {
+        const BatchJob &job = jobs[i];
+        const BatchResult &result = results[i];
+
+        char status[32];
+        if (!result.loaded) std::snprintf(status, sizeof(status), "unreadable");
+        else if (result.halt_instruction != 0) std::snprintf(status, sizeof(status), "unimplemented %04X", result.halt_instruction);
+        else if (result.halted) std::snprintf(status, sizeof(status), "halted");
+        else std::snprintf(status, sizeof(status), "ok");
+
+        char hash[17];
+        std::snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)result.run.framebuffer_hash);
+
+        out << job.rom << '\t' << result.run.frames << '\t' << job.options.instructions_per_second << '\t' << job.options.seed << '\t'
+            << status << '\t' << (result.loaded ? hash : "-") << '\t' << result.run.instructions << '\t'
+            << result.run.wall.count() / 1e6 << '\n';
+    }
+}
+
+}
@@ -0,0 +1,187 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "batch.h"
+#include "machine.h"
+#include "runner.h"
+#include "snapshot.h"
+
+// Runs a ROM, or a whole batch of them, without a window and prints where they
+// ended up. Used by CI and batch jobs that only need the final state
+static void usage() {
+    std::fprintf(stderr,
+        "usage: chip8_headless [options] <rom>\n"
+        "       chip8_headless [options] --load-state <file>\n"
+        "       chip8_headless [options] --batch <directory|manifest>\n"
+        "  --frames N       60 Hz frames to run (default 600)\n"
+        "  --cpu-hz N       instructions per second (default 700)\n"
+        "  --seed N         random number seed (default 1)\n"
+        "  --key F:K[:D]    hold keypad key K (hex) for D frames from frame F, can be repeated\n"
+        "  --script FILE    more --key entries, one per line, '#' starts a comment\n"
+        "  --dynarec        use the dynamic recompiler if this build has it\n"
+        "  --load-state F   start from a snapshot file instead of a ROM\n"
+        "  --save-state F   write a snapshot of the final state to F\n"
+        "batch mode runs every .ch8/.c8 ROM of a directory, or every line of a manifest\n"
+        "(path[<tab>frames[<tab>cpu-hz[<tab>seed]]]), and prints a results table:\n"
+        "  --jobs N         worker threads (default one per hardware thread)\n"
+        "  --output FILE    write the table to FILE instead of the standard output\n");
+}
+
+static bool parseNumber(const char *text, uint64_t &value) {
+    char *end = nullptr;
+    value = std::strtoull(text, &end, 10);
+    return end != text && *end == '\0';
+}
+
+static bool readScript(const std::string &path, chip8::RunOptions &options) {
+    std::ifstream fin(path);
+    if (!fin.is_open()) return false;
+
+    std::string line;
+    while (std::getline(fin, line)) {
+        size_t comment = line.find('#');
+        if (comment != std::string::npos) line.erase(comment);
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos) continue;
+        line = line.substr(first, line.find_last_not_of(" \t\r") - first + 1);
+
+        chip8::KeyPress press;
+        if (!chip8::parseKeyPress(line, press)) {
+            std::fprintf(stderr, "%s: bad key entry '%s'\n", path.c_str(), line.c_str());
+            return false;
+        }
+        options.input.push_back(press);
+    }
+    return true;
+}
+
+static int runBatch(const std::string &source, const chip8::RunOptions &options, unsigned jobs, const std::string &output) {
+    std::vector<chip8::BatchJob> batch;
+    if (!chip8::loadBatch(source, options, batch)) {
+        std::fprintf(stderr, "%s: cannot read the batch\n", source.c_str());
+        return 1;
+    }
+
+    std::ofstream fout;
+    if (!output.empty()) {
+        fout.open(output);
+        if (!fout.is_open()) {
+            std::fprintf(stderr, "%s: cannot write the results\n", output.c_str());
+            return 1;
+        }
+    }
+
+    chip8::ThreadPool pool(jobs);
+    chip8::runBatch(batch, pool, output.empty() ? std::cout : fout);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    chip8::RunOptions options;
+    std::string rom;
+    std::string batch;
+    std::string output;
+    std::string load_state;
+    std::string save_state;
+    unsigned jobs = 0;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = (i + 1 < argc ? argv[i + 1] : nullptr);
+        uint64_t number = 0;
+
+        if (std::strcmp(arg, "--dynarec") == 0) {
+            options.dynarec = true;
+            continue;
+        }
+        if (arg[0] != '-') {
+            rom = arg;
+            continue;
+        }
+        if (value == nullptr) {
+            usage();
+            return 2;
+        }
+        i++;
+
+        chip8::KeyPress press;
+        if (std::strcmp(arg, "--frames") == 0 && parseNumber(value, number)) options.frames = number;
+        else if (std::strcmp(arg, "--cpu-hz") == 0 && parseNumber(value, number) && number > 0 && number <= UINT32_MAX) options.instructions_per_second = (uint32_t)number;
+        else if (std::strcmp(arg, "--seed") == 0 && parseNumber(value, number)) options.seed = (uint32_t)number;
+        else if (std::strcmp(arg, "--key") == 0 && chip8::parseKeyPress(value, press)) options.input.push_back(press);
+        else if (std::strcmp(arg, "--script") == 0) {
+            if (!readScript(value, options)) return 2;
+        }
+        else if (std::strcmp(arg, "--load-state") == 0) load_state = value;
+        else if (std::strcmp(arg, "--save-state") == 0) save_state = value;
+        else if (std::strcmp(arg, "--batch") == 0) batch = value;
+        else if (std::strcmp(arg, "--output") == 0) output = value;
+        else if (std::strcmp(arg, "--jobs") == 0 && parseNumber(value, number) && number > 0 && number <= 4096) jobs = (unsigned)number;
+        else {
+            usage();
+            return 2;
+        }
+    }
+    if (!batch.empty() && !(load_state.empty() && save_state.empty())) {
+        std::fprintf(stderr, "--batch cannot be combined with --load-state or --save-state\n");
+        return 2;
+    }
+    if (!batch.empty())
+        return runBatch(batch, options, jobs, output);
+    if (rom.empty() == load_state.empty()) {
+        usage();
+        return 2;
+    }
+
+    chip8::Machine machine;
+    machine.seed(options.seed);
+    machine.setStrict(true); // an undefined opcode is reported and ends the run instead of being skipped
+    if (options.dynarec && !machine.setDynarec(true))
+        std::fprintf(stderr, "This build has no dynamic recompiler, interpreting instead\n");
+    if (!load_state.empty()) {
+        // The snapshot holds the program and the random number state, so it replaces both the ROM and the seed
+        chip8::Snapshot snapshot;
+        if (!chip8::loadSnapshot(load_state, snapshot) || !machine.load(snapshot)) {
+            std::fprintf(stderr, "%s: not a snapshot this version can load\n", load_state.c_str());
+            return 1;
+        }
+        rom = load_state;
+    }
+    else if (!machine.loadRom(rom)) {
+        std::fprintf(stderr, "%s: cannot load the ROM\n", rom.c_str());
+        return 1;
+    }
+
+    chip8::RunResult result = chip8::runFrames(machine, options);
+    if (!save_state.empty()) {
+        chip8::Snapshot snapshot;
+        machine.save(snapshot);
+        if (!chip8::saveSnapshot(snapshot, save_state)) {
+            std::fprintf(stderr, "%s: cannot write the snapshot\n", save_state.c_str());
+            return 1;
+        }
+    }
+
+    double seconds = result.wall.count() / 1e9;
+    std::printf("rom          %s\n", rom.c_str());
+    std::printf("frames       %llu%s\n", (unsigned long long)result.frames,
+                machine.halted() ? " (halted)" : (machine.waitingForKey() ? " (waiting for a key)" : ""));
+    std::printf("framebuffer  %016llx\n", (unsigned long long)result.framebuffer_hash);
+    std::printf("pc %03X  I %03X  sp %u  dt %u  st %u\n", machine.pc, machine.I, machine.sp, machine.delay_timer.get(), machine.audio_timer.get());
+    std::printf("V ");
+    for (int k = 0; k < 16; k++) std::printf(" %02X", machine.V[k]);
+    std::printf("\n");
+    std::printf("instructions %llu (%llu skipped idle)\n", (unsigned long long)result.instructions, (unsigned long long)machine.idleCycles());
+    std::printf("time         %.3f ms, %.1fx real time\n", seconds * 1000,
+                seconds > 0 ? result.frames / (double)TIMER_HZ / seconds : 0.0);
+
+    if (machine.halted() && machine.haltInstruction() != 0) {
+        std::printf("unimplemented instruction %04X\n", machine.haltInstruction());
+        return 1;
+    }
+    return 0;
+}
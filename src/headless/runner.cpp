@@ -0,0 +1,64 @@
+#include "runner.h"
+
+#include <cstdlib>
+
+#include "scheduler.h"
+
+namespace chip8{
+
+bool parseKeyPress(const std::string &text, KeyPress &press) {
+    const char *cursor = text.c_str();
+    char *end = nullptr;
+
+    press.frame = std::strtoull(cursor, &end, 10);
+    if (end == cursor || *end != ':') return false;
+    cursor = end + 1;
+
+    unsigned long key = std::strtoul(cursor, &end, 16);
+    if (end == cursor || key > 0xF) return false;
+    press.key = (uint8_t)key;
+    press.frames = 1;
+    if (*end == '\0') return true;
+    if (*end != ':') return false;
+    cursor = end + 1;
+
+    press.frames = std::strtoull(cursor, &end, 10);
+    return end != cursor && *end == '\0';
+}
+
+uint64_t framebufferHash(const Machine &machine) {
+    uint64_t hash = 14695981039346656037ull;
+    for (int line = 0; line < SCREEN_HEIGHT; line++) {
+        for (int byte = 0; byte < 8; byte++) {
+            hash ^= (machine.display[line] >> (8 * byte)) & 0xFF;
+            hash *= 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
+RunResult runFrames(Machine &machine, const RunOptions &options) {
+    using clock = std::chrono::steady_clock;
+
+    Scheduler scheduler(machine, options.instructions_per_second);
+    RunResult result;
+    clock::time_point start = clock::now();
+
+    for (uint64_t frame = 0; frame < options.frames && !machine.halted(); frame++) {
+        uint16_t keys = 0;
+        for (const KeyPress &press : options.input) {
+            if (frame >= press.frame && frame - press.frame < press.frames) keys |= 1u << press.key;
+        }
+        machine.setKeys(keys);
+
+        // The rate is never unlimited here, so the deadline is not used
+        result.instructions += scheduler.tick(clock::time_point::max());
+        result.frames++;
+    }
+
+    result.wall = clock::now() - start;
+    result.framebuffer_hash = framebufferHash(machine);
+    return result;
+}
+
+}
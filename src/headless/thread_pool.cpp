@@ -0,0 +1,96 @@
+#include "thread_pool.h"
+
+namespace chip8{
+
+ThreadPool::ThreadPool(unsigned threads) : queued(0), pending(0), next(0), sleepers(0), stopping(false) {
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+    if (threads == 0) threads = 1;
+
+    for (unsigned i = 0; i < threads; i++)
+        queues.emplace_back(new Queue());
+    for (unsigned i = 0; i < threads; i++)
+        workers.emplace_back(&ThreadPool::work, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> guard(state_lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &worker : workers)
+        worker.join();
+}
+
+void ThreadPool::submit(std::function<void()> job) {
+    unsigned index = next.fetch_add(1) % queues.size();
+    pending.fetch_add(1);
+    {
+        std::lock_guard<std::mutex> guard(queues[index]->lock);
+        queues[index]->jobs.push_back(std::move(job));
+    }
+    queued.fetch_add(1);
+
+    // A worker about to sleep counts itself in `sleepers` and then checks `queued` under the
+    // lock, so either it sees this job or this sees it and the lock waits until it is asleep
+    if (sleepers.load() > 0) {
+        { std::lock_guard<std::mutex> guard(state_lock); }
+        wake.notify_one();
+    }
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> guard(state_lock);
+    idle.wait(guard, [this] { return pending.load() == 0; });
+}
+
+unsigned ThreadPool::size() const {
+    return (unsigned)workers.size();
+}
+
+bool ThreadPool::take(unsigned index, std::function<void()> &job) {
+    {
+        Queue &own = *queues[index];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (!own.jobs.empty()) {
+            job = std::move(own.jobs.back());
+            own.jobs.pop_back();
+            return true;
+        }
+    }
+    for (size_t offset = 1; offset < queues.size(); offset++) {
+        Queue &victim = *queues[(index + offset) % queues.size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.jobs.empty()) {
+            job = std::move(victim.jobs.front());
+            victim.jobs.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::work(unsigned index) {
+    while (true) {
+        std::function<void()> job;
+        if (take(index, job)) {
+            queued.fetch_sub(1);
+            job();
+            if (pending.fetch_sub(1) == 1) {
+                // wait() checks `pending` under the lock, taking it here means the notification cannot slip in before
+                { std::lock_guard<std::mutex> guard(state_lock); }
+                idle.notify_all();
+            }
+            continue;
+        }
+
+        // A whole sweep found nothing, sleep until a job is queued
+        std::unique_lock<std::mutex> guard(state_lock);
+        sleepers.fetch_add(1);
+        wake.wait(guard, [this] { return queued.load() > 0 || stopping; });
+        sleepers.fetch_sub(1);
+        if (stopping && queued.load() == 0) return;
+    }
+}
+
+}
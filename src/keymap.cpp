@@ -0,0 +1,49 @@
+#include "keymap.h"
+
+#include <algorithm>
+
+namespace chip8{
+
+Keymap::Keymap() {
+    setLayout("hex");
+}
+
+bool Keymap::setLayout(const std::string &name) {
+    if (name == "hex") {
+        std::fill(keys, keys + SDL_NUM_SCANCODES, unbound);
+        keys[SDL_SCANCODE_0] = 0x0;
+        for (uint8_t key = 1; key <= 9; key++)
+            keys[SDL_SCANCODE_1 + key - 1] = key;
+        for (uint8_t key = 0xA; key <= 0xF; key++)
+            keys[SDL_SCANCODE_A + key - 0xA] = key;
+        return true;
+    }
+    if (name == "qwerty") {
+        static const SDL_Scancode block[16] = {
+            SDL_SCANCODE_1, SDL_SCANCODE_2, SDL_SCANCODE_3, SDL_SCANCODE_4,
+            SDL_SCANCODE_Q, SDL_SCANCODE_W, SDL_SCANCODE_E, SDL_SCANCODE_R,
+            SDL_SCANCODE_A, SDL_SCANCODE_S, SDL_SCANCODE_D, SDL_SCANCODE_F,
+            SDL_SCANCODE_Z, SDL_SCANCODE_X, SDL_SCANCODE_C, SDL_SCANCODE_V
+        };
+        static const uint8_t keypad[16] = {
+            0x1, 0x2, 0x3, 0xC,
+            0x4, 0x5, 0x6, 0xD,
+            0x7, 0x8, 0x9, 0xE,
+            0xA, 0x0, 0xB, 0xF
+        };
+        std::fill(keys, keys + SDL_NUM_SCANCODES, unbound);
+        for (int i = 0; i < 16; i++)
+            keys[block[i]] = keypad[i];
+        return true;
+    }
+    return false;
+}
+
+bool Keymap::bind(const std::string &scancode_name, uint8_t key) {
+    SDL_Scancode scancode = SDL_GetScancodeFromName(scancode_name.c_str());
+    if (scancode == SDL_SCANCODE_UNKNOWN || (key > 0xF && key != unbound)) return false;
+    keys[scancode] = key;
+    return true;
+}
+
+}
@@ -1,25 +1,29 @@
 #include "screen.h"
 
-bool screen[SCREEN_HEIGHT][SCREEN_WIDTH] = {};
+#include <algorithm>
 
 int pixel_size = 10;
 int current_screen_width = 800;
 int current_screen_height = 500;
 
-int screen_off_x = 0;
-int screen_off_y = 0;
-
 SDL_Window *window = nullptr;
-SDL_Surface *surface = nullptr;
+SDL_Renderer *renderer = nullptr;
+SDL_Texture *texture = nullptr;
 SDL_Event event;
 
-std::map<unsigned char, bool> key_pressed = {};
+std::atomic<uint16_t> key_pressed{0};
+// Key-down edges since the last takePresses(), they stay set after the key is released
+static std::atomic<uint16_t> key_went_down{0};
+// Read by the event watch, which runs on the main thread like setKeymap()
+static chip8::Keymap keymap;
+static SDL_Scancode rewind_key = SDL_SCANCODE_UNKNOWN;
+static std::atomic<bool> rewind_held{false};
 
-void reload_screen()
+// Draws the framebuffer texture scaled to the window, the space around it is left gray
+void present_screen()
 {
-    int max_pixel_x = current_screen_width / SCREEN_WIDTH;
-    int max_pixel_y = current_screen_height / SCREEN_HEIGHT;
-    pixel_size = std::min(max_pixel_x, max_pixel_y);
+    if (renderer == nullptr)
+        return;
 
     SDL_Rect c8_screen;
     c8_screen.w = pixel_size * SCREEN_WIDTH;
@@ -27,28 +31,19 @@ void reload_screen()
     c8_screen.x = current_screen_width / 2 - c8_screen.w / 2;
     c8_screen.y = current_screen_height / 2 - c8_screen.h / 2;
 
-    screen_off_x = current_screen_width / 2 - c8_screen.w / 2;
-    screen_off_y = current_screen_height / 2 - c8_screen.h / 2;
+    SDL_SetRenderDrawColor(renderer, 50, 50, 50, 255);
+    SDL_RenderClear(renderer);
+    SDL_RenderCopy(renderer, texture, NULL, &c8_screen);
+    SDL_RenderPresent(renderer);
+}
 
-    SDL_FillRect(surface, NULL, SDL_MapRGB(surface->format, 50, 50, 50));
-    for (int i = 0; i < SCREEN_HEIGHT; i++)
-    {
-        for (int j = 0; j < SCREEN_WIDTH; j++)
-        {
-            Uint32 color;
-            if (screen[i][j] == 0)
-                color = SDL_MapRGB(surface->format, 0, 0, 0);
-            else
-                color = SDL_MapRGB(surface->format, 255, 255, 255);
-            SDL_Rect ree;
-            ree.x = screen_off_x + pixel_size * j;
-            ree.y = screen_off_y + pixel_size * i;
-            ree.w = pixel_size - 1;
-            ree.h = pixel_size - 1;
-            SDL_FillRect(surface, &ree, color);
-        }
-    }
-    SDL_UpdateWindowSurface(window);
+void reload_screen()
+{
+    int max_pixel_x = current_screen_width / SCREEN_WIDTH;
+    int max_pixel_y = current_screen_height / SCREEN_HEIGHT;
+    pixel_size = std::max(1, std::min(max_pixel_x, max_pixel_y));
+
+    present_screen();
 }
 
 int handleEventsInternal(void *userdata, SDL_Event *event)
@@ -56,65 +51,34 @@ int handleEventsInternal(void *userdata, SDL_Event *event)
     switch (event->type)
     {
     case SDL_QUIT:
+        SDL_DestroyTexture(texture);
+        SDL_DestroyRenderer(renderer);
         SDL_DestroyWindow(window);
+        texture = nullptr;
+        renderer = nullptr;
         window = nullptr;
         break;
     case SDL_KEYDOWN:
     case SDL_KEYUP:
     {
-        unsigned char key = 0;
-        switch (event->key.keysym.sym)
+        if (rewind_key != SDL_SCANCODE_UNKNOWN && event->key.keysym.scancode == rewind_key)
         {
-        case SDLK_0:
-            key = 0;
-            break;
-        case SDLK_1:
-            key = 1;
-            break;
-        case SDLK_2:
-            key = 2;
-            break;
-        case SDLK_3:
-            key = 3;
-            break;
-        case SDLK_4:
-            key = 4;
-            break;
-        case SDLK_5:
-            key = 5;
-            break;
-        case SDLK_6:
-            key = 6;
-            break;
-        case SDLK_7:
-            key = 7;
-            break;
-        case SDLK_8:
-            key = 8;
-            break;
-        case SDLK_9:
-            key = 9;
-            break;
-        case SDLK_a:
-            key = 10;
-            break;
-        case SDLK_b:
-            key = 11;
-            break;
-        case SDLK_c:
-            key = 12;
-            break;
-        case SDLK_d:
-            key = 13;
-            break;
-        case SDLK_e:
-            key = 14;
+            rewind_held.store(event->type == SDL_KEYDOWN, std::memory_order_relaxed);
             break;
-        case SDLK_f:
-            key = 15;
+        }
+        uint8_t key = keymap.lookup(event->key.keysym.scancode);
+        if (key > 0xF)
             break;
+        if (event->type == SDL_KEYDOWN)
+        {
+            key_pressed.fetch_or((uint16_t)(1u << key), std::memory_order_relaxed);
+            // Auto-repeat is not a new press, FX0A only takes keys that were up when it started
+            if (!event->key.repeat)
+                key_went_down.fetch_or((uint16_t)(1u << key), std::memory_order_relaxed);
         }
-        key_pressed[key] = (event->type == SDL_KEYDOWN ? 1 : 0);
+        else
+            key_pressed.fetch_and((uint16_t)~(1u << key), std::memory_order_relaxed);
+        break;
     }
     case SDL_WINDOWEVENT:
     {
@@ -122,7 +86,6 @@ int handleEventsInternal(void *userdata, SDL_Event *event)
         {
         case SDL_WINDOWEVENT_SIZE_CHANGED:
         {
-            surface = SDL_GetWindowSurface(window);
             int width = event->window.data1;
             int height = event->window.data2;
             current_screen_width = width;
@@ -132,6 +95,11 @@ int handleEventsInternal(void *userdata, SDL_Event *event)
 
             break;
         }
+        case SDL_WINDOWEVENT_EXPOSED:
+        {
+            present_screen();
+            break;
+        }
         case SDL_WINDOWEVENT_RESIZED:
         {
             // God knows what triggers this event
@@ -154,136 +122,86 @@ namespace chip8
     Screen::Screen()
     {
         window = SDL_CreateWindow("Chip-8 Emulator", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, current_screen_width, current_screen_height, SDL_WINDOW_RESIZABLE);
-        surface = SDL_GetWindowSurface(window);
+        renderer = SDL_CreateRenderer(window, -1, 0);
+        texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, SCREEN_WIDTH, SCREEN_HEIGHT);
+        std::fill(&pixels[0][0], &pixels[0][0] + SCREEN_WIDTH * SCREEN_HEIGHT, 0xFF000000);
+        SDL_UpdateTexture(texture, NULL, pixels, sizeof(pixels[0]));
 
         SDL_AddEventWatch(handleEventsInternal, NULL);
 
         reload_screen();
     }
 
+    void Screen::setKeymap(const Keymap &map)
+    {
+        keymap = map;
+    }
+    void Screen::setRewindKey(SDL_Scancode scancode)
+    {
+        rewind_key = scancode;
+    }
+    bool Screen::rewindHeld()
+    {
+        return rewind_held.load(std::memory_order_relaxed);
+    }
     bool Screen::getKeyState(unsigned int key)
     {
-        if (key_pressed.find(key) == key_pressed.end())
-            return 0;
-        return key_pressed[key];
+        return key <= 0xF && ((keyMask() >> key) & 1);
     }
-    unsigned char Screen::awaitKeyPress()
+    uint16_t Screen::keyMask()
     {
-        while (true)
-        {
-            SDL_PollEvent(&event);
-            if (event.type == SDL_KEYDOWN)
-            {
-                unsigned char key = 0;
-                switch (event.key.keysym.sym)
-                {
-                case SDLK_0:
-                    key = 0;
-                    break;
-                case SDLK_1:
-                    key = 1;
-                    break;
-                case SDLK_2:
-                    key = 2;
-                    break;
-                case SDLK_3:
-                    key = 3;
-                    break;
-                case SDLK_4:
-                    key = 4;
-                    break;
-                case SDLK_5:
-                    key = 5;
-                    break;
-                case SDLK_6:
-                    key = 6;
-                    break;
-                case SDLK_7:
-                    key = 7;
-                    break;
-                case SDLK_8:
-                    key = 8;
-                    break;
-                case SDLK_9:
-                    key = 9;
-                    break;
-                case SDLK_a:
-                    key = 10;
-                    break;
-                case SDLK_b:
-                    key = 11;
-                    break;
-                case SDLK_c:
-                    key = 12;
-                    break;
-                case SDLK_d:
-                    key = 13;
-                    break;
-                case SDLK_e:
-                    key = 14;
-                    break;
-                case SDLK_f:
-                    key = 15;
-                    break;
-                default:
-                    key = 100;
-                    break;
-                }
-
-                if (key >= 0 && key <= 15)
-                    return key;
-            }
-        }
+        return key_pressed.load(std::memory_order_relaxed);
+    }
+    uint16_t Screen::takePresses()
+    {
+        return key_went_down.exchange(0, std::memory_order_relaxed);
     }
     void Screen::handleEvents()
     {
         while (SDL_PollEvent(&event))
             ;
     }
+    void Screen::waitEvents(std::chrono::steady_clock::time_point deadline)
+    {
+        // The event watch updates the keys while SDL waits
+        while (window != nullptr)
+        {
+            auto left = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+            if (left <= 0)
+                return;
+            SDL_WaitEventTimeout(&event, (int)left);
+        }
+    }
     bool Screen::closed()
     {
         return (window == nullptr);
     }
 
-    void Screen::drawPixel(int x, int y)
+    void Screen::draw(const uint64_t display[SCREEN_HEIGHT], uint32_t dirty_rows)
     {
-        screen[y][x] = 1;
+        if (texture == nullptr || dirty_rows == 0)
+            return;
 
-        SDL_Rect rect;
-        rect.x = screen_off_x + x * pixel_size;
-        rect.y = screen_off_y + y * pixel_size;
-        rect.w = pixel_size - 1;
-        rect.h = pixel_size - 1;
-        SDL_FillRect(surface, &rect, SDL_MapRGB(surface->format, 255, 255, 255));
-
-        SDL_Rect rectt[1];
-        rectt[0].x = screen_off_x + x * pixel_size;
-        rectt[0].y = screen_off_y + y * pixel_size;
-        rectt[0].w = pixel_size - 1;
-        rectt[0].h = pixel_size - 1;
-        SDL_UpdateWindowSurfaceRects(window, rectt, 1);
-    }
-    void Screen::erasePixel(int x, int y)
-    {
-        screen[y][x] = 0;
+        int first = -1, last = -1;
+        for (int i = 0; i < SCREEN_HEIGHT; i++)
+        {
+            if (((dirty_rows >> i) & 1) == 0)
+                continue;
+            for (int j = 0; j < SCREEN_WIDTH; j++)
+                pixels[i][j] = ((display[i] >> (SCREEN_WIDTH - 1 - j)) & 1 ? 0xFFFFFFFF : 0xFF000000);
+            if (first == -1)
+                first = i;
+            last = i;
+        }
 
-        SDL_Rect rect;
-        rect.x = screen_off_x + x * pixel_size;
-        rect.y = screen_off_y + y * pixel_size;
-        rect.w = pixel_size - 1;
-        rect.h = pixel_size - 1;
-        SDL_FillRect(surface, &rect, SDL_MapRGB(surface->format, 0, 0, 0));
+        SDL_Rect rows;
+        rows.x = 0;
+        rows.y = first;
+        rows.w = SCREEN_WIDTH;
+        rows.h = last - first + 1;
+        SDL_UpdateTexture(texture, &rows, pixels[first], sizeof(pixels[0]));
 
-        SDL_Rect rectt[1];
-        rectt[0].x = screen_off_x + x * pixel_size;
-        rectt[0].y = screen_off_y + y * pixel_size;
-        rectt[0].w = pixel_size - 1;
-        rectt[0].h = pixel_size - 1;
-        SDL_UpdateWindowSurfaceRects(window, rectt, 1);
-    }
-    void Screen::clear()
-    {
-        SDL_FillRect(surface, NULL, SDL_MapRGB(surface->format, 0, 0, 0));
+        present_screen();
     }
 
 }
@@ -0,0 +1,67 @@
+#include "test_util.h"
+
+// Programs that rewrite their own code. The decoded instruction cache has to
+// notice every write, both when the program runs with run() and with step()
+static void check(chip8test::Failures &failures, int program, const unsigned char *rom, size_t size,
+                  uint8_t reg, uint8_t expected) {
+    for (int stepped = 0; stepped < 2; stepped++) {
+        chip8::Machine machine;
+        machine.loadRom(rom, size);
+        if (stepped) {
+            for (int i = 0; i < 100; i++) machine.step();
+        }
+        else {
+            machine.run(100);
+        }
+        if (machine.V[reg] != expected) failures.add(program, stepped ? "step() ran a stale instruction" : "run() ran a stale instruction");
+    }
+}
+
+int main() {
+    chip8test::Failures failures("cache");
+
+    // FX55 replaces an instruction that already ran
+    static const unsigned char store[] = {
+        0x6A, 0x00,     // 200 VA = 0, becomes VA = 42
+        0x3A, 0x00,     // 202 skip if VA == 0
+        0x12, 0x10,     // 204 jump to the end
+        0x60, 0x6A,     // 206 V0 = 6A
+        0x61, 0x42,     // 208 V1 = 42
+        0xA2, 0x00,     // 20A I = 200
+        0xF1, 0x55,     // 20C store V0 and V1 at 200
+        0x12, 0x00,     // 20E jump back to 200
+        0x12, 0x10,     // 210 the end
+    };
+    check(failures, 0, store, sizeof(store), 0xA, 0x42);
+
+    // FX33 writes the second byte of the instruction at 200 and the whole next one
+    static const unsigned char bcd[] = {
+        0x6B, 0x00,     // 200 VB = 0, becomes VB = 2
+        0x3C, 0x00,     // 202 skip if VC == 0, becomes 0000 which does nothing
+        0x12, 0x12,     // 204 jump to the end
+        0x6C, 0x01,     // 206 VC = 1
+        0x6D, 0xC8,     // 208 VD = 200
+        0xA2, 0x01,     // 20A I = 201
+        0xFD, 0x33,     // 20C store 2, 0, 0 at 201
+        0x12, 0x00,     // 20E jump back to 200
+        0x00, 0x00,     // 210
+        0x12, 0x12,     // 212 the end
+    };
+    check(failures, 1, bcd, sizeof(bcd), 0xB, 2);
+
+    // Memory written from outside the machine is picked up after flushCache()
+    static const unsigned char outside[] = {
+        0x6E, 0x01,     // 200 VE = 1, becomes VE = 5
+        0x12, 0x02,     // 202 jump to itself
+    };
+    chip8::Machine machine;
+    machine.loadRom(outside, sizeof(outside));
+    machine.run(10);
+    machine.memory[0x201] = 0x05;
+    machine.flushCache();
+    machine.pc = 0x200;
+    machine.run(10);
+    if (machine.V[0xE] != 5) failures.add(2, "flushCache() kept a stale instruction");
+
+    return failures.exitCode();
+}
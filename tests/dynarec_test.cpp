@@ -0,0 +1,56 @@
+#include "test_util.h"
+
+// Runs random straight-line heavy programs with the interpreter and with the
+// dynamic recompiler. Both have to execute the same number of instructions
+// and end in the same state, with strict mode off and on
+int main() {
+    chip8::Machine probe;
+    if (!probe.setDynarec(true)) {
+        std::printf("dynarec: not in this build, skipped\n");
+        return 77;
+    }
+
+    std::mt19937 random(42);
+    chip8test::Failures failures("dynarec");
+    static const uint16_t alu[] = { 0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0xE, 0x9 }; // 8XY9 is undefined
+
+    for (int program = 0; program < 20000; program++) {
+        unsigned char rom[512];
+        for (int i = 0; i < 512; i += 2) {
+            uint16_t x = random() % 16, y = random() % 16, nn = random() & 0xFF;
+            uint16_t op;
+            // Mostly instructions the dynarec translates, with the ones that end its blocks in between
+            switch (random() % 20) {
+            case 0: case 1: case 2: op = 0x6000 | x << 8 | nn; break;
+            case 3: case 4: op = 0x7000 | x << 8 | nn; break;
+            case 5: case 6: case 7: case 8: case 9: case 10: op = 0x8000 | x << 8 | y << 4 | alu[random() % 10]; break;
+            case 11: op = 0xA000 | (random() & 0xFFF); break;
+            case 12: op = 0xF01E | x << 8; break;
+            case 13: op = 0xF029 | x << 8; break;
+            case 14: op = 0xF065 | x << 8; break;
+            case 15: op = 0xF055 | x << 8; break;
+            case 16: op = 0xF033 | x << 8; break;
+            case 17: op = 0x3000 | x << 8 | nn; break;
+            case 18: op = 0x1200 | (random() & 0x1FE); break;
+            default: op = 0x2200 | (random() & 0x1FE); break;
+            }
+            rom[i] = op >> 8;
+            rom[i + 1] = op & 0xFF;
+        }
+
+        chip8::Machine interpreted, translated;
+        interpreted.loadRom(rom, sizeof(rom));
+        translated.loadRom(rom, sizeof(rom));
+        translated.setDynarec(true);
+        interpreted.setStrict(program % 2 == 1);
+        translated.setStrict(program % 2 == 1);
+        for (int slice = 0; slice < 50; slice++) {
+            if (interpreted.run(37) != translated.run(37)) {
+                failures.add(program, "different instruction counts");
+                break;
+            }
+        }
+        if (!chip8test::sameState(interpreted, translated)) failures.add(program, "different states");
+    }
+    return failures.exitCode();
+}
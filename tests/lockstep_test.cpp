@@ -0,0 +1,94 @@
+#include <memory>
+
+#include "lockstep.h"
+#include "test_util.h"
+
+// Runs random programs on Lanes separate Machines and on one Lockstep<Lanes>
+// with the same seeds and keys. Every lane has to end like its Machine
+template <int Lanes>
+static void compare(chip8test::Failures &failures, int programs, std::mt19937 &random) {
+    for (int program = 0; program < programs; program++) {
+        unsigned char rom[256];
+        for (int i = 0; i < 256; i += 2) {
+            // Any opcode, with extra jumps, calls and returns so the lanes split up and meet again
+            uint16_t op = random() & 0xFFFF;
+            switch (random() % 6) {
+            case 0: op = 0x1200 | (random() & 0xFE); break;
+            case 1: op = 0x2200 | (random() & 0xFE); break;
+            case 2: op = 0x00EE; break;
+            case 3: op = 0xA200 | (random() & 0xFF); break;
+            }
+            rom[i] = op >> 8;
+            rom[i + 1] = op & 0xFF;
+        }
+
+        chip8::Machine base;
+        base.loadRom(rom, sizeof(rom));
+        std::unique_ptr<chip8::Lockstep<Lanes>> lockstep(new chip8::Lockstep<Lanes>(base));
+        std::unique_ptr<chip8::Machine[]> machines(new chip8::Machine[Lanes]);
+        for (int l = 0; l < Lanes; l++) {
+            // Every third program gives all lanes the same seed so they stay together longer
+            uint32_t seed = (program % 3 == 0 ? 5 : l + 1);
+            machines[l].loadRom(rom, sizeof(rom));
+            machines[l].seed(seed);
+            lockstep->seed(l, seed);
+        }
+
+        for (int tick = 0; tick < 60; tick++) {
+            for (int l = 0; l < Lanes; l++) {
+                uint16_t keys = 0;
+                if (program % 2 == 1) keys = random() & 0xFFFF;
+                if (program % 4 == 1) keys = (tick % 5 == 0 ? 1u << (tick % 16) : 0);
+                machines[l].setKeys(keys);
+                lockstep->setKeys(l, keys);
+            }
+            for (int i = 0; i < 23; i++) {
+                for (int l = 0; l < Lanes; l++) machines[l].step();
+            }
+            lockstep->run(23);
+            for (int l = 0; l < Lanes; l++) machines[l].tickTimers();
+            lockstep->tickTimers();
+        }
+
+        for (int l = 0; l < Lanes; l++) {
+            chip8::Machine lane;
+            lockstep->store(l, lane);
+            if (!chip8test::sameState(lane, machines[l])) {
+                failures.add(program, "a lane differs from its machine");
+                break;
+            }
+        }
+    }
+}
+
+// Half the lanes block in FX0A, the other half must keep running in lockstep
+static void blockedLanes(chip8test::Failures &failures) {
+    // 200 C001  rnd V0
+    // 202 3000  skip if V0 == 0
+    // 204 1208  jump to the loop
+    // 206 F00A  wait for a key
+    // 208 7101  the loop
+    // 20A 8124
+    // 20C 1208
+    static const unsigned char rom[] = { 0xC0, 0x01, 0x30, 0x00, 0x12, 0x08, 0xF0, 0x0A, 0x71, 0x01, 0x81, 0x24, 0x12, 0x08 };
+    chip8::Machine base;
+    base.loadRom(rom, sizeof(rom));
+    std::unique_ptr<chip8::Lockstep<32>> lockstep(new chip8::Lockstep<32>(base));
+    int waiting = 0;
+    for (int l = 0; l < 32; l++) lockstep->seed(l, l * 7919 + 1);
+    lockstep->run(100000);
+    for (int l = 0; l < 32; l++) waiting += lockstep->waitingForKey(l);
+
+    if (waiting == 0 || waiting == 32) failures.add(0, "the seeds did not split the lanes");
+    if (lockstep->scalarSteps() > 1000) failures.add(0, "the running lanes did not converge");
+}
+
+int main() {
+    std::mt19937 random(7);
+    chip8test::Failures failures("lockstep");
+    compare<8>(failures, 1000, random);
+    compare<16>(failures, 200, random);
+    compare<32>(failures, 200, random);
+    blockedLanes(failures);
+    return failures.exitCode();
+}
@@ -0,0 +1,92 @@
+#include "test_util.h"
+
+// Runs random programs one instruction at a time with step() and in slices of
+// random length with run(). Both have to end every 60 Hz tick in the same state,
+// also when run() skips idle loops
+
+// Any opcode, with extra jumps, calls and returns so the programs keep moving around the ROM
+static uint16_t anyProgramOp(std::mt19937 &random, uint16_t) {
+    switch (random() % 8) {
+    case 0: return 0x1200 | (random() & 0xFE);
+    case 1: return 0x2200 | (random() & 0xFE);
+    case 2: return 0x00EE;
+    default: return random() & 0xFFFF;
+    }
+}
+
+// The pieces of the superinstructions (6XNN 6XNN DXYN, 3XNN 1NNN, FX07 3XNN 1NNN) and what breaks them up.
+// The random run() slices often end in the middle of one, which then has to run unfused
+static uint16_t fusedProgramOp(std::mt19937 &random, uint16_t) {
+    uint16_t x = random() % 16, y = random() % 16, nn = random() & 0xFF;
+    switch (random() % 8) {
+    case 0: return 0x6000 | x << 8 | nn;
+    case 1: return 0xD000 | x << 8 | y << 4 | (random() % 16);
+    case 2: return 0x3000 | x << 8 | (random() % 3);
+    case 3: return 0x1200 | (random() & 0xFE);
+    case 4: return 0xF007 | x << 8;
+    case 5: return 0xF015 | x << 8;
+    case 6: return 0xA000 | (random() & 0xFFF);
+    default: return 0xF055 | x << 8;
+    }
+}
+
+// The pieces of the loops run() skips: jumps to themselves, EX9E or EXA1 followed by a jump
+// back to it, and FX07 3XNN 1NNN waiting for the delay timer, with the jumps aimed at `address`
+static uint16_t idleProgramOp(std::mt19937 &random, uint16_t address) {
+    uint16_t x = random() % 4, nn = random() % 4;
+    switch (random() % 10) {
+    case 0: return 0x1000 | address;
+    case 1: case 2: return 0x1000 | ((address - 2) & 0x0FFF);
+    case 3: return 0x1000 | ((address - 4) & 0x0FFF);
+    case 4: return 0xE09E | x << 8;
+    case 5: return 0xE0A1 | x << 8;
+    case 6: return 0xF007 | x << 8;
+    case 7: return 0x3000 | x << 8 | nn;
+    case 8: return 0xF015 | x << 8;
+    default: return 0x6000 | x << 8 | (random() % 32);
+    }
+}
+
+static void compare(chip8test::Failures &failures, int program, uint16_t (*generate)(std::mt19937 &, uint16_t), std::mt19937 &random) {
+    unsigned char rom[256];
+    for (int i = 0; i < 256; i += 2) {
+        uint16_t op = generate(random, (uint16_t)(chip8::Machine::mem_offset + i));
+        rom[i] = op >> 8;
+        rom[i + 1] = op & 0xFF;
+    }
+
+    chip8::Machine stepped, ran;
+    stepped.loadRom(rom, sizeof(rom));
+    ran.loadRom(rom, sizeof(rom));
+    for (int tick = 0; tick < 40; tick++) {
+        uint16_t keys = (tick % 7 < 3 ? 1u << (random() % 16) : 0);
+        chip8test::setKeys(stepped, keys);
+        chip8test::setKeys(ran, keys);
+
+        for (int i = 0; i < 23; i++) stepped.step();
+        for (int left = 23; left > 0;) {
+            int slice = 1 + random() % 8;
+            if (slice > left) slice = left;
+            ran.run(slice);
+            left -= slice;
+        }
+        stepped.tickTimers();
+        ran.tickTimers();
+        if (!chip8test::sameState(stepped, ran)) {
+            failures.add(program, "different states");
+            return;
+        }
+    }
+}
+
+int main() {
+    std::mt19937 random(7);
+    chip8test::Failures failures("run");
+    for (int program = 0; program < 5000; program++)
+        compare(failures, program, anyProgramOp, random);
+    for (int program = 0; program < 5000; program++)
+        compare(failures, program, fusedProgramOp, random);
+    for (int program = 0; program < 5000; program++)
+        compare(failures, program, idleProgramOp, random);
+    return failures.exitCode();
+}
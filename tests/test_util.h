@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+#include "machine.h"
+
+// Helpers shared by the tests. Most of them run programs on two engines that
+// must agree and compare the whole machine state afterwards
+namespace chip8test{
+
+// True when both machines are in the same state, as far as a program can tell
+inline bool sameState(const chip8::Machine &a, const chip8::Machine &b) {
+    return std::memcmp(a.V, b.V, sizeof(a.V)) == 0 && a.I == b.I && a.pc == b.pc && a.sp == b.sp
+        && std::memcmp(a.stack, b.stack, sizeof(a.stack)) == 0
+        && std::memcmp(a.memory, b.memory, sizeof(a.memory)) == 0
+        && std::memcmp(a.display, b.display, sizeof(a.display)) == 0
+        && a.delay_timer.get() == b.delay_timer.get() && a.audio_timer.get() == b.audio_timer.get()
+        && a.halted() == b.halted() && a.haltInstruction() == b.haltInstruction()
+        && a.waitingForKey() == b.waitingForKey();
+}
+
+// Sets the whole keypad, bit n is key n
+inline void setKeys(chip8::Machine &machine, uint16_t mask) {
+    for (unsigned int key = 0; key < 16; key++)
+        machine.setKey(key, (mask >> key) & 1);
+}
+
+// Prints the first few failures and counts all of them
+class Failures{
+public:
+    explicit Failures(const char *name) : name(name) {}
+
+    void add(int program, const char *what) {
+        if (count < 5) std::printf("%s: program %d, %s\n", name, program, what);
+        count++;
+    }
+    int exitCode() const {
+        std::printf("%s: %d failures\n", name, count);
+        return count == 0 ? 0 : 1;
+    }
+
+private:
+    const char *name;
+    int count = 0;
+};
+
+}